@@ -0,0 +1,201 @@
+#include <ingest.h>
+#include <synthetic_corpus.h>
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+
+// Usage: end_to_end [--corpus-mb N] [--files N] [--vocab N] [--words N] [--zipf S] [--word-length L]
+//                   [--scripts W1,W2,W3,W4] [--seed N] [--work-dir DIR] [--json PATH]
+//
+// Generates a synthetic corpus, then ingests it, trains to the target vocabulary size, saves, loads, encodes
+// and decodes it, reporting the throughput of every stage. The same options always produce the same corpus,
+// so the numbers of different releases are comparable.
+namespace
+{
+    struct Stage
+    {
+        std::string name;
+        double seconds;
+        double megabytes; // Bytes processed by the stage, 0 when throughput is not meaningful
+        double items;     // Merges or tokens
+        std::string itemName;
+    };
+
+    double secondsSince(std::chrono::steady_clock::time_point start)
+    {
+        return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    }
+}
+
+int main(int argc, char **argv)
+{
+    dokusha::SyntheticCorpusOptions corpusOptions;
+    double corpusMegabytes = 32;
+    size_t numFiles = 8;
+    unsigned short targetVocabularySize = 2048;
+    std::string workDirectory = (std::filesystem::temp_directory_path() / "dokusha_end_to_end").string();
+    std::string jsonPath;
+
+    for (int i = 1; i + 1 < argc; i += 2)
+    {
+        std::string flag = argv[i];
+        if (flag == "--corpus-mb")
+        {
+            corpusMegabytes = std::stod(argv[i + 1]);
+        }
+        else if (flag == "--files")
+        {
+            numFiles = std::stoul(argv[i + 1]);
+        }
+        else if (flag == "--vocab")
+        {
+            targetVocabularySize = std::stoul(argv[i + 1]);
+        }
+        else if (flag == "--words")
+        {
+            corpusOptions.vocabularySize = std::stoul(argv[i + 1]);
+        }
+        else if (flag == "--zipf")
+        {
+            corpusOptions.zipfExponent = std::stod(argv[i + 1]);
+        }
+        else if (flag == "--word-length")
+        {
+            corpusOptions.meanWordLength = std::stod(argv[i + 1]);
+        }
+        else if (flag == "--scripts")
+        {
+            std::istringstream weights(argv[i + 1]);
+            std::string weight;
+            for (size_t script = 0; script < corpusOptions.scriptWeights.size() && std::getline(weights, weight, ','); script++)
+            {
+                corpusOptions.scriptWeights[script] = std::stod(weight);
+            }
+        }
+        else if (flag == "--seed")
+        {
+            corpusOptions.seed = std::stoull(argv[i + 1]);
+        }
+        else if (flag == "--work-dir")
+        {
+            workDirectory = argv[i + 1];
+        }
+        else if (flag == "--json")
+        {
+            jsonPath = argv[i + 1];
+        }
+    }
+
+    std::vector<Stage> stages;
+    auto start = std::chrono::steady_clock::now();
+
+    dokusha::SyntheticCorpus corpus(corpusOptions);
+    std::filesystem::remove_all(workDirectory);
+    std::vector<std::string> corpusFiles = corpus.writeFiles((std::filesystem::path(workDirectory) / "corpus").string(),
+                                                             static_cast<uint64_t>(corpusMegabytes * 1e6), numFiles);
+    double corpusBytes = 0;
+    for (const auto &path : corpusFiles)
+    {
+        corpusBytes += std::filesystem::file_size(path);
+    }
+    stages.push_back({"generate", secondsSince(start), corpusBytes / 1e6, 0, ""});
+
+    dokusha::BPETokenizer<std::string> tokenizer;
+    start = std::chrono::steady_clock::now();
+    if (dokusha::ingestFailed(dokusha::ingestCorpus((std::filesystem::path(workDirectory) / "corpus").string(), tokenizer, 0)))
+    {
+        std::cerr << "Ingesting the corpus failed" << std::endl;
+        return 1;
+    }
+    stages.push_back({"ingest", secondsSince(start), corpusBytes / 1e6, 0, ""});
+
+    start = std::chrono::steady_clock::now();
+    tokenizer.pruneWordList();
+    size_t merges = 0;
+    while (tokenizer.getVocabularySize() < targetVocabularySize)
+    {
+        unsigned short before = tokenizer.getVocabularySize();
+        tokenizer.runLearningIteration();
+        if (tokenizer.getVocabularySize() == before)
+        {
+            break; // No pair is left to merge
+        }
+        merges++;
+    }
+    tokenizer.compileMergeTable();
+    stages.push_back({"train", secondsSince(start), 0, static_cast<double>(merges), "merges"});
+
+    std::string tokenizerPath = (std::filesystem::path(workDirectory) / "tokenizer.bin").string();
+    start = std::chrono::steady_clock::now();
+    tokenizer.save(tokenizerPath, 10000);
+    double tokenizerBytes = std::filesystem::file_size(tokenizerPath);
+    stages.push_back({"save", secondsSince(start), tokenizerBytes / 1e6, 0, ""});
+
+    dokusha::BPETokenizer<std::string> loaded;
+    start = std::chrono::steady_clock::now();
+    loaded.load(tokenizerPath);
+    stages.push_back({"load", secondsSince(start), tokenizerBytes / 1e6, 0, ""});
+
+    std::vector<std::string> lines;
+    for (const auto &path : corpusFiles)
+    {
+        std::ifstream in(path);
+        std::string line;
+        while (std::getline(in, line))
+        {
+            lines.push_back(std::move(line));
+        }
+    }
+
+    // Batches the size the encode pipeline hands to tokenizeBatch
+    static constexpr size_t batchSize = 1024;
+    std::vector<std::vector<unsigned short>> encoded;
+    encoded.reserve(lines.size());
+    double tokens = 0;
+    start = std::chrono::steady_clock::now();
+    for (size_t begin = 0; begin < lines.size(); begin += batchSize)
+    {
+        std::vector<std::string> batch(lines.begin() + begin, lines.begin() + std::min(lines.size(), begin + batchSize));
+        for (auto &tokenized : loaded.tokenizeBatch(batch))
+        {
+            tokens += tokenized.size();
+            encoded.push_back(std::move(tokenized));
+        }
+    }
+    stages.push_back({"encode", secondsSince(start), corpusBytes / 1e6, tokens, "tokens"});
+
+    start = std::chrono::steady_clock::now();
+    std::vector<std::string> decoded = loaded.detokenizeBatch(encoded);
+    stages.push_back({"decode", secondsSince(start), corpusBytes / 1e6, tokens, "tokens"});
+
+    std::cout << "Corpus: " << corpusBytes / 1e6 << " MB in " << corpusFiles.size() << " files, " << lines.size()
+              << " lines, vocabulary " << loaded.getVocabularySize() << std::endl;
+    std::ostringstream json;
+    json << "{\"corpus_bytes\":" << corpusBytes << ",\"vocabulary_size\":" << loaded.getVocabularySize() << ",\"stages\":{";
+    for (size_t i = 0; i < stages.size(); i++)
+    {
+        const Stage &stage = stages[i];
+        std::cout << stage.name << ": " << stage.seconds << " s";
+        json << (i > 0 ? "," : "") << "\"" << stage.name << "\":{\"seconds\":" << stage.seconds;
+        if (stage.megabytes > 0)
+        {
+            std::cout << ", " << stage.megabytes / stage.seconds << " MB/s";
+            json << ",\"mb_per_second\":" << stage.megabytes / stage.seconds;
+        }
+        if (stage.items > 0)
+        {
+            std::cout << ", " << stage.items / stage.seconds << " " << stage.itemName << "/s";
+            json << ",\"" << stage.itemName << "_per_second\":" << stage.items / stage.seconds;
+        }
+        std::cout << std::endl;
+        json << "}";
+    }
+    json << "}}";
+
+    if (!jsonPath.empty())
+    {
+        std::ofstream(jsonPath) << json.str() << std::endl;
+    }
+    return 0;
+}
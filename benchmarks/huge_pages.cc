@@ -0,0 +1,127 @@
+#include <bpe.h>
+#include <huge_page_allocator.h>
+#include <synthetic_corpus.h>
+#include <chrono>
+#include <fstream>
+#include <sstream>
+#include <sys/wait.h>
+#include <unistd.h>
+
+// Usage: huge_pages [--lines N] [--words N] [--iterations N] [--modes off,thp,hugetlb]
+//
+// Builds a large training state from a synthetic corpus and times pair counting and full training steps with
+// the word table and pair counts backed by regular pages, transparent huge pages and MAP_HUGETLB pages. The
+// mode is fixed by the first allocation, so every mode runs in a child process of its own. MAP_HUGETLB needs
+// pages reserved in /proc/sys/vm/nr_hugepages and falls back to transparent huge pages without them, which in
+// turn need /sys/kernel/mm/transparent_hugepage/enabled set to madvise or always.
+namespace
+{
+    double secondsSince(std::chrono::steady_clock::time_point start)
+    {
+        return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    // Anonymous memory of the process the kernel backs with transparent huge pages
+    uint64_t anonHugePagesKilobytes()
+    {
+        std::ifstream rollup("/proc/self/smaps_rollup");
+        for (std::string line; std::getline(rollup, line);)
+        {
+            if (line.starts_with("AnonHugePages:"))
+            {
+                return std::stoull(line.substr(line.find_first_of("0123456789")));
+            }
+        }
+        return 0;
+    }
+
+    void runMode(dokusha::HugePageMode mode, size_t lines, size_t words, unsigned iterations)
+    {
+        dokusha::hugepages::setMode(mode);
+        dokusha::SyntheticCorpusOptions corpusOptions;
+        corpusOptions.vocabularySize = words;
+        dokusha::SyntheticCorpus corpus(corpusOptions);
+        dokusha::BPETokenizer<std::string> tokenizer;
+
+        auto start = std::chrono::steady_clock::now();
+        for (size_t i = 0; i < lines; i++)
+        {
+            std::string line;
+            corpus.appendLine(line);
+            tokenizer.addToCorpus(line);
+        }
+        double buildSeconds = secondsSince(start);
+
+        start = std::chrono::steady_clock::now();
+        for (unsigned i = 0; i < iterations; i++)
+        {
+            tokenizer.computePairFrequency();
+        }
+        double pairCountSeconds = secondsSince(start) / iterations;
+
+        start = std::chrono::steady_clock::now();
+        for (unsigned i = 0; i < iterations; i++)
+        {
+            tokenizer.runLearningIteration();
+        }
+        double iterationSeconds = secondsSince(start) / iterations;
+
+        std::cout << dokusha::hugepages::modeName(mode) << ": build " << buildSeconds << " s, pair count " << pairCountSeconds * 1000
+                  << " ms, learning iteration " << iterationSeconds * 1000 << " ms, AnonHugePages " << anonHugePagesKilobytes() / 1024
+                  << " MB, regions " << dokusha::hugepages::toJson() << std::endl;
+    }
+}
+
+int main(int argc, char **argv)
+{
+    size_t lines = 400000;
+    size_t words = 2000000;
+    unsigned iterations = 5;
+    std::string modes = "off,thp,hugetlb";
+    for (int i = 1; i + 1 < argc; i += 2)
+    {
+        std::string flag = argv[i];
+        if (flag == "--lines")
+        {
+            lines = std::stoul(argv[i + 1]);
+        }
+        else if (flag == "--words")
+        {
+            words = std::stoul(argv[i + 1]);
+        }
+        else if (flag == "--iterations")
+        {
+            iterations = std::max(1ul, std::stoul(argv[i + 1]));
+        }
+        else if (flag == "--modes")
+        {
+            modes = argv[i + 1];
+        }
+        else
+        {
+            std::cerr << "Unknown option " << flag << std::endl;
+            return 1;
+        }
+    }
+
+    std::istringstream modeList(modes);
+    for (std::string name; std::getline(modeList, name, ',');)
+    {
+        dokusha::HugePageMode mode = dokusha::hugepages::parseMode(name, dokusha::HugePageMode::Off);
+        std::cout.flush();
+        pid_t child = fork();
+        if (child == 0)
+        {
+            runMode(mode, lines, words, iterations);
+            std::cout.flush();
+            _exit(0);
+        }
+        int status = 0;
+        if (child < 0 || waitpid(child, &status, 0) != child || !WIFEXITED(status) || WEXITSTATUS(status) != 0)
+        {
+            std::cerr << "Mode " << name << " failed" << std::endl;
+            return 1;
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,294 @@
+#include <bpe.h>
+#include <synthetic_corpus.h>
+#include <benchmark/benchmark.h>
+#include <cstring>
+#include <filesystem>
+#include <memory>
+#include <sstream>
+
+// Microbenchmarks of the encode, decode and training hot loops on a synthetic corpus.
+//
+// Hardware counters are recorded with google-benchmark's --benchmark_perf_counters, which needs the library
+// built against libpfm (configure with -DDOKUSHA_BENCHMARK_PERF_COUNTERS=ON), e.g.
+//
+//   kernels --benchmark_perf_counters=CYCLES,INSTRUCTIONS,BRANCH-MISSES,L1-DCACHE-LOAD-MISSES,LLC-LOAD-MISSES
+//
+// google-benchmark reports them per iteration. Every benchmark here also counts the tokens or merges one
+// iteration processes, and the reporter below adds each hardware counter divided by that, so runs on
+// different inputs and layouts compare per token or per merge.
+namespace
+{
+    constexpr size_t corpusLines = 20000;
+    constexpr unsigned short vocabularySize = 1024;
+    constexpr unsigned short trainingStartVocabularySize = 512; // Training kernels start from this state
+
+    struct Fixture
+    {
+        std::vector<std::string> lines;
+        std::vector<std::string> longWords; // Whole lines with spaces removed, for the long word paths
+        dokusha::BPETokenizer<std::string> tokenizer;
+        dokusha::BPETokenizer<std::string> tokenizerWithTable; // Also has the frequent word table
+        dokusha::BPETokenizer<std::string> trainingState;
+        std::vector<std::vector<unsigned short>> encoded;
+        size_t bytes = 0;
+        size_t tokens = 0;
+
+        Fixture()
+        {
+            dokusha::SyntheticCorpus corpus(dokusha::SyntheticCorpusOptions{});
+            for (size_t i = 0; i < corpusLines; i++)
+            {
+                std::string line;
+                corpus.appendLine(line);
+                this->bytes += line.size();
+                this->lines.push_back(line);
+                this->tokenizer.addToCorpus(line);
+                std::erase(line, ' ');
+                this->longWords.push_back(line);
+            }
+
+            this->tokenizer.pruneWordList();
+            while (this->tokenizer.getVocabularySize() < vocabularySize)
+            {
+                if (this->tokenizer.getVocabularySize() == trainingStartVocabularySize)
+                {
+                    this->trainingState = this->tokenizer;
+                }
+                this->tokenizer.runLearningIteration();
+            }
+            this->tokenizer.compileMergeTable();
+
+            std::string path = (std::filesystem::temp_directory_path() / "dokusha_kernels_tokenizer.bin").string();
+            this->tokenizer.save(path, 10000);
+            this->tokenizerWithTable.load(path);
+            std::filesystem::remove(path);
+
+            this->encoded = this->tokenizer.tokenizeBatch(this->lines);
+            for (const auto &tokenized : this->encoded)
+            {
+                this->tokens += tokenized.size();
+            }
+        }
+    };
+
+    const Fixture &fixture()
+    {
+        static Fixture instance;
+        return instance;
+    }
+
+    void setUnit(benchmark::State &state, const char *unit, double perIteration, size_t bytesPerIteration)
+    {
+        state.counters[unit] = benchmark::Counter(perIteration);
+        state.SetItemsProcessed(state.iterations() * perIteration);
+        if (bytesPerIteration > 0)
+        {
+            state.SetBytesProcessed(state.iterations() * bytesPerIteration);
+        }
+    }
+
+    void BM_Tokenize(benchmark::State &state)
+    {
+        const Fixture &data = fixture();
+        for (auto _ : state)
+        {
+            for (const auto &line : data.lines)
+            {
+                benchmark::DoNotOptimize(data.tokenizer.tokenize(line));
+            }
+        }
+        setUnit(state, "tokens", data.tokens, data.bytes);
+    }
+
+    // Argument 1 encodes through the frequent word table
+    void BM_TokenizeBatch(benchmark::State &state)
+    {
+        const Fixture &data = fixture();
+        const auto &tokenizer = state.range(0) == 1 ? data.tokenizerWithTable : data.tokenizer;
+        for (auto _ : state)
+        {
+            benchmark::DoNotOptimize(tokenizer.tokenizeBatch(data.lines));
+        }
+        setUnit(state, "tokens", data.tokens, data.bytes);
+    }
+
+    // Words of a whole line each, which tokenizeBatch hands to the automaton
+    void BM_TokenizeLongWords(benchmark::State &state)
+    {
+        const Fixture &data = fixture();
+        size_t tokens = 0;
+        size_t bytes = 0;
+        for (const auto &tokenized : data.tokenizer.tokenizeBatch(data.longWords))
+        {
+            tokens += tokenized.size();
+        }
+        for (const auto &word : data.longWords)
+        {
+            bytes += word.size();
+        }
+        for (auto _ : state)
+        {
+            benchmark::DoNotOptimize(data.tokenizer.tokenizeBatch(data.longWords));
+        }
+        setUnit(state, "tokens", tokens, bytes);
+    }
+
+    void BM_CountTokens(benchmark::State &state)
+    {
+        const Fixture &data = fixture();
+        for (auto _ : state)
+        {
+            for (const auto &line : data.lines)
+            {
+                benchmark::DoNotOptimize(data.tokenizer.countTokens(line));
+            }
+        }
+        setUnit(state, "tokens", data.tokens, data.bytes);
+    }
+
+    void BM_DetokenizeBatch(benchmark::State &state)
+    {
+        const Fixture &data = fixture();
+        for (auto _ : state)
+        {
+            benchmark::DoNotOptimize(data.tokenizer.detokenizeBatch(data.encoded));
+        }
+        setUnit(state, "tokens", data.tokens, data.bytes);
+    }
+
+    void BM_PairCount(benchmark::State &state)
+    {
+        auto tokenizer = std::make_unique<dokusha::BPETokenizer<std::string>>(fixture().trainingState);
+        for (auto _ : state)
+        {
+            tokenizer->computePairFrequency();
+        }
+        setUnit(state, "merges", 1, 0);
+    }
+
+    void BM_BestPair(benchmark::State &state)
+    {
+        auto tokenizer = std::make_unique<dokusha::BPETokenizer<std::string>>(fixture().trainingState);
+        tokenizer->computePairFrequency();
+        for (auto _ : state)
+        {
+            benchmark::DoNotOptimize(tokenizer->findBestPair());
+        }
+        setUnit(state, "merges", 1, 0);
+    }
+
+    // One full training step per iteration, starting over from the saved state whenever the vocabulary is full
+    void BM_LearningIteration(benchmark::State &state)
+    {
+        auto tokenizer = std::make_unique<dokusha::BPETokenizer<std::string>>(fixture().trainingState);
+        for (auto _ : state)
+        {
+            if (tokenizer->getVocabularySize() >= vocabularySize)
+            {
+                state.PauseTiming();
+                *tokenizer = fixture().trainingState;
+                state.ResumeTiming();
+            }
+            tokenizer->runLearningIteration();
+        }
+        setUnit(state, "merges", 1, 0);
+    }
+
+    BENCHMARK(BM_Tokenize)->Unit(benchmark::kMillisecond);
+    BENCHMARK(BM_TokenizeBatch)->Arg(0)->Arg(1)->Unit(benchmark::kMillisecond);
+    BENCHMARK(BM_TokenizeLongWords)->Unit(benchmark::kMillisecond);
+    BENCHMARK(BM_CountTokens)->Unit(benchmark::kMillisecond);
+    BENCHMARK(BM_DetokenizeBatch)->Unit(benchmark::kMillisecond);
+    BENCHMARK(BM_PairCount)->Unit(benchmark::kMicrosecond);
+    BENCHMARK(BM_BestPair)->Unit(benchmark::kMicrosecond);
+    BENCHMARK(BM_LearningIteration)->Unit(benchmark::kMicrosecond);
+
+    // Adds <counter>/token or <counter>/merge for every hardware counter of a run that counts tokens or merges
+    template <typename Base>
+    class NormalizingReporter : public Base
+    {
+    public:
+        explicit NormalizingReporter(std::vector<std::string> perfCounters) : perfCounters(std::move(perfCounters)) {}
+
+        void ReportRuns(const std::vector<benchmark::BenchmarkReporter::Run> &runs) override
+        {
+            std::vector<benchmark::BenchmarkReporter::Run> normalized = runs;
+            for (auto &run : normalized)
+            {
+                for (const auto &[unit, suffix] : {std::pair<std::string, std::string>{"tokens", "/token"}, {"merges", "/merge"}})
+                {
+                    auto units = run.counters.find(unit);
+                    if (units == run.counters.end() || units->second.value <= 0)
+                    {
+                        continue;
+                    }
+                    double perIteration = units->second.value;
+                    for (const auto &name : this->perfCounters)
+                    {
+                        auto counter = run.counters.find(name);
+                        if (counter != run.counters.end())
+                        {
+                            run.counters[name + suffix] = benchmark::Counter(counter->second.value / perIteration);
+                        }
+                    }
+                }
+            }
+            Base::ReportRuns(normalized);
+        }
+
+    private:
+        std::vector<std::string> perfCounters;
+    };
+
+    std::vector<std::string> requestedPerfCounters(int argc, char **argv)
+    {
+        static constexpr const char *flag = "--benchmark_perf_counters=";
+        std::vector<std::string> names;
+        for (int i = 1; i < argc; i++)
+        {
+            if (std::strncmp(argv[i], flag, std::strlen(flag)) == 0)
+            {
+                std::istringstream list(argv[i] + std::strlen(flag));
+                std::string name;
+                while (std::getline(list, name, ','))
+                {
+                    names.push_back(name);
+                }
+            }
+        }
+        return names;
+    }
+}
+
+int main(int argc, char **argv)
+{
+    std::vector<std::string> perfCounters = requestedPerfCounters(argc, argv);
+    bool jsonDisplay = false;
+    bool fileOutput = false;
+    for (int i = 1; i < argc; i++)
+    {
+        jsonDisplay |= std::strcmp(argv[i], "--benchmark_format=json") == 0;
+        fileOutput |= std::strncmp(argv[i], "--benchmark_out=", std::strlen("--benchmark_out=")) == 0;
+    }
+
+    benchmark::Initialize(&argc, argv);
+    if (benchmark::ReportUnrecognizedArguments(argc, argv))
+    {
+        return 1;
+    }
+
+    NormalizingReporter<benchmark::ConsoleReporter> console(perfCounters);
+    NormalizingReporter<benchmark::JSONReporter> json(perfCounters);
+    NormalizingReporter<benchmark::JSONReporter> file(perfCounters);
+    benchmark::BenchmarkReporter *display = jsonDisplay ? static_cast<benchmark::BenchmarkReporter *>(&json) : &console;
+    if (fileOutput)
+    {
+        benchmark::RunSpecifiedBenchmarks(display, &file);
+    }
+    else
+    {
+        benchmark::RunSpecifiedBenchmarks(display);
+    }
+    benchmark::Shutdown();
+    return 0;
+}
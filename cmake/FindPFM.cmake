@@ -0,0 +1,13 @@
+# Finds libpfm for the vendored google-benchmark, which links PFM::libpfm when PFM_FOUND is set
+find_path(PFM_INCLUDE_DIR perfmon/pfmlib.h)
+find_library(PFM_LIBRARY pfm)
+
+include(FindPackageHandleStandardArgs)
+find_package_handle_standard_args(PFM REQUIRED_VARS PFM_LIBRARY PFM_INCLUDE_DIR)
+
+if(PFM_FOUND AND NOT TARGET PFM::libpfm)
+    add_library(PFM::libpfm UNKNOWN IMPORTED)
+    set_target_properties(PFM::libpfm PROPERTIES
+        IMPORTED_LOCATION "${PFM_LIBRARY}"
+        INTERFACE_INCLUDE_DIRECTORIES "${PFM_INCLUDE_DIR}")
+endif()
@@ -1,12 +1,23 @@
 #ifndef BPE_H
 #define BPE_H
 
+#include <algorithm>
+#include <cstdint>
 #include <iostream>
+#include <optional>
 #include <unordered_map>
 #include <unordered_set>
 #include <string>
+#include <string_view>
 #include <vector>
 #include <utils.h>
+#include <memory_usage.h>
+#include <merge_table.h>
+#include <bpe_automaton.h>
+#include <decode_table.h>
+#include <special_tokens.h>
+#include <numa_topology.h>
+#include <huge_page_allocator.h>
 #include <omp.h>
 #include <fstream>
 
@@ -33,42 +44,214 @@ namespace dokusha
         }
     };
 
+    // Token IDs with, in a parallel array, the byte offset in the original input where every token starts
+    struct TokenizedText
+    {
+        std::vector<unsigned short> ids;
+        std::vector<uint32_t> offsets;
+    };
+
     template <typename T>
     class BPETokenizer
     {
     private:
-        std::unordered_map<std::string, std::pair<std::vector<T>, unsigned>> wordWiseTokenListWithFrequency;
+        // The tables that grow with the corpus go through HugePageAllocator, see hugepages::setMode
+        using TokenList = std::vector<T, HugePageAllocator<T>>;
+        using WordTable = std::unordered_map<std::string, std::pair<TokenList, unsigned>, std::hash<std::string>, std::equal_to<std::string>,
+                                             HugePageAllocator<std::pair<const std::string, std::pair<TokenList, unsigned>>>>;
+        using PairCounts = std::unordered_map<std::pair<T, T>, unsigned, PairHash, PairEqual, HugePageAllocator<std::pair<const std::pair<T, T>, unsigned>>>;
+
+        WordTable wordWiseTokenListWithFrequency;
         std::unordered_map<std::pair<T, T>, T, PairHash, PairEqual> mergeRules;
-        std::unordered_map<std::pair<T, T>, unsigned, PairHash, PairEqual> pairFrequency;
+        std::vector<std::pair<std::pair<T, T>, T>> rankedMergeRules; // mergeRules in the order they were learned
+        PairCounts pairFrequency;
         unsigned short vocabularySize;
         std::unordered_map<T, unsigned short> vocabulary;
         std::unordered_map<unsigned short, T> inverseVocabulary;
         static constexpr unsigned short frequencyPruneThreshold = 2;
         std::unordered_set<T> baseVocabulary;
+        // Final encodings of the most frequent training words, shipped in the tokenizer file and never modified after load
+        std::unordered_map<std::string, std::vector<unsigned short>> frequentWordEncodings;
+        static constexpr unsigned char frequentWordSection = 1;
+        MergeTable mergeTable;
+        BPEAutomaton automaton; // Only compiled when the merge rules are canonical
+        DecodeTable decodeTable;
+        SpecialTokens specialTokens;
+        static constexpr unsigned char specialTokenSection = 2;
+        // vocabularyLimits[k] is one past the largest ID the base vocabulary and the first k merge rules produce
+        std::vector<uint32_t> vocabularyLimits;
+        // addToCorpus keeps only the words hashing to partition wordPartitionIndex of wordPartitionCount
+        unsigned wordPartitionIndex = 0;
+        unsigned wordPartitionCount = 1;
+
+        // The words of the corpus split over the threads of a training team by setNumaTraining. Each
+        // partition points at token lists its own thread copied, so they sit on that thread's node.
+        struct TrainingPartition
+        {
+            ThreadPlacement placement;
+            std::vector<std::pair<TokenList *, unsigned>> words; // Token list and frequency
+            PairCounts pairCounts;
+        };
+        // The pointers belong to the tokenizer that built the partitions, so a copy starts empty and
+        // partitions again on first use
+        struct TrainingPartitions
+        {
+            std::vector<TrainingPartition> partitions;
+
+            TrainingPartitions() = default;
+            TrainingPartitions(const TrainingPartitions &) {}
+            TrainingPartitions &operator=(const TrainingPartitions &)
+            {
+                this->partitions.clear();
+                return *this;
+            }
+        };
+        bool numaTraining = false;
+        TrainingPartitions trainingPartitions;
+
+        void partitionForTraining();
+        void computePartitionedPairFrequency();
+        // Replaces every non-overlapping occurrence of token1 token2, left to right; true if there was one
+        static bool mergeTokens(TokenList &tokens, const T &token1, const T &token2);
+
+        // Calls visit on every word of an already trimmed text, split exactly like preTokenize splits it,
+        // until visit returns false
+        template <typename Visitor>
+        static void forEachWord(std::string_view text, Visitor &&visit)
+        {
+            size_t begin = 0;
+            while (begin <= text.size())
+            {
+                size_t end = text.find(' ', begin + 1);
+                if (end == std::string_view::npos)
+                {
+                    end = text.size();
+                }
+                if (!visit(text.substr(begin, end - begin)))
+                {
+                    return;
+                }
+                begin = end == text.size() ? end + 1 : end;
+            }
+        }
+
+        // Like forEachWord, but special tokens are cut out of the text first and every word is only split from
+        // the text between them. visit gets each word with -1, or a special token with its ID.
+        template <typename Visitor>
+        void forEachPiece(std::string_view text, Visitor &&visit) const
+        {
+            if (this->specialTokens.empty())
+            {
+                forEachWord(text, [&visit](std::string_view word) { return visit(word, -1); });
+                return;
+            }
+
+            size_t begin = 0;
+            while (true)
+            {
+                size_t length;
+                unsigned short tokenId;
+                size_t position = this->specialTokens.find(text, begin, length, tokenId);
+                std::string_view span = text.substr(begin, (position == SpecialTokens::npos ? text.size() : position) - begin);
+
+                bool proceed = true;
+                if (!span.empty())
+                {
+                    forEachWord(span, [&](std::string_view word) { return proceed = visit(word, -1); });
+                }
+                if (!proceed || position == SpecialTokens::npos || !visit(text.substr(position, length), tokenId))
+                {
+                    return;
+                }
+                begin = position + length;
+            }
+        }
+
+        void encodeWordWithMergeLimit(std::string_view word, size_t mergeLimit, std::vector<unsigned short> &output) const;
+        bool decodeTableIsCurrent() const { return this->decodeTable.isCompiledFor(this->inverseVocabulary.size() + this->specialTokens.size()); }
 
     public:
         BPETokenizer();
         ~BPETokenizer();
         void addToCorpus(std::string &line);
+        void mergeCorpus(BPETokenizer<T> &other);
+        // Restricts the corpus to one hash partition of its words, so that several processes can each hold a part
+        void setWordPartition(unsigned index, unsigned count);
+        std::pair<unsigned, unsigned> getWordPartition() const { return {this->wordPartitionIndex, this->wordPartitionCount}; }
+        // Hands over every corpus word with its frequency and empties the word table
+        std::vector<std::pair<std::string, unsigned>> releaseCorpus();
         void pruneWordList();
         void pruneRedundantTokens();
+        // Trains on all OpenMP threads, pinned to CPUs spread over the NUMA nodes (see NumaTopology). Every thread
+        // owns the words it copied itself, so their pages are local to its node, and counts their pairs; the counts
+        // are folded on every node first and then across nodes. Among equally frequent pairs a different one may
+        // win than in the serial training. The placement is exported as "training_topology" in stats::toJson().
+        void setNumaTraining(bool enabled);
         void computePairFrequency();
-        void applyMergeRule(const std::pair<std::pair<T, T>, T> &rule, std::vector<T> &rawTokenList);
+        template <typename TokenVector>
+        void applyMergeRule(const std::pair<std::pair<T, T>, T> &rule, TokenVector &rawTokenList) const;
         void inline addToMergeRule(const std::pair<T, T> &bestPair, const T &combinedToken);
         void inline addToVocabulary(const T &token);
         void inline addToVocabulary(const T &token, unsigned short tokenIndex);
         void updateWordWiseTokenList(const T &token1, const T &token2);
         T combineTokens(std::pair<T, T> bestPair);
+        // Learns the merge of pair without applying it to the corpus and returns the ID of the merged token
+        unsigned short addMerge(const std::pair<T, T> &pair);
         std::pair<T, T> findBestPair();
         std::string extractToken(std::string &currentWord, size_t &index);
-        std::vector<unsigned short> tokenize(std::string text);
+        std::vector<std::vector<T>> preTokenize(std::string text) const;
+        void encodeWord(std::string_view word, std::vector<unsigned short> &output) const;
+        std::vector<unsigned short> encodeWords(std::vector<std::vector<T>> &tokenList) const;
+        // Encodes text the way tokenize() encodes it after trimming
+        void encodeSpan(std::string_view text, std::vector<unsigned short> &output) const;
+        std::vector<unsigned short> tokenize(std::string text) const;
+        // Stops pre-tokenizing and encoding once maxTokens tokens are produced and returns the first maxTokens
+        std::vector<unsigned short> tokenize(const std::string &text, size_t maxTokens) const;
+        // Same tokens as tokenize(text). Offsets refer to text itself, before trimming.
+        TokenizedText tokenizeWithOffsets(const std::string &text) const;
+        // Same as tokenize(text).size(), without materializing the tokens of the whole text
+        size_t countTokens(const std::string &text) const;
+        std::vector<std::vector<unsigned short>> tokenizeBatch(const std::vector<std::string> &texts) const;
+        // Encodes with only the first mergeLimit merge rules, which gives exactly the output of the tokenizer this one
+        // was while training, after learning that many rules. One tokenizer file thereby serves every smaller vocabulary
+        // size it passed. The frequent word table and the automaton hold encodings under all rules, so this goes
+        // through the merge table, or replays the rules when the table is not compiled.
+        std::vector<unsigned short> tokenizeWithMergeLimit(const std::string &text, size_t mergeLimit) const;
+        void encodeSpan(std::string_view text, std::vector<unsigned short> &output, size_t mergeLimit) const;
+        size_t getMergeRuleCount() const { return this->rankedMergeRules.size(); }
+        // The rule learned rank-th, as ((left, right), merged)
+        const std::pair<std::pair<T, T>, T> &getMergeRule(size_t rank) const { return this->rankedMergeRules[rank]; }
+        // IDs the first mergeLimit merge rules can produce are below this; special tokens come on top
+        size_t vocabularyLimit(size_t mergeLimit) const;
+        bool isValidTokenId(unsigned short tokenId, size_t mergeLimit) const
+        {
+            return tokenId < this->vocabularyLimit(mergeLimit) || this->specialTokens.tokens().contains(tokenId);
+        }
+        // Builds the read-only encode and decode tables from the learned rules, load() does so automatically
+        void compileMergeTable();
+        // Registers a token that is never split and always encodes to tokenId. The ID must not be used by the
+        // vocabulary, and as training hands out IDs in sequence, special tokens are best added after training.
+        bool addSpecialToken(const std::string &token, unsigned short tokenId);
+        // Bytes of a single token, empty for an unknown ID
+        std::string_view tokenBytes(unsigned short tokenId) const;
+        std::optional<unsigned short> tokenId(const T &token) const;
         std::string detokenize(std::vector<unsigned short> tokenizedText);
+        // Decodes every sequence on all OpenMP threads
+        std::vector<std::string> detokenizeBatch(const std::vector<std::vector<unsigned short>> &tokenizedTexts) const;
+        // Returns nullopt if any ID is outside the vocabulary of the first mergeLimit merge rules and not a special token
+        std::optional<std::string> detokenizeWithMergeLimit(const std::vector<unsigned short> &tokenizedText, size_t mergeLimit) const;
         void runLearningIteration();
         const unsigned short getVocabularySize() const;
+        // Estimated heap bytes of every training and encoding structure. Walks all of them, so it costs about
+        // as much as one pair count and is best sampled every so many training iterations rather than after each.
+        // Tables on HugePageAllocator are counted in its size classes, not in malloc chunks.
+        MemoryUsage memoryUsage() const;
         
 
-        void save(const std::string filepath) const;
-        void load(const std::string filepath);
+        void save(const std::string filepath, size_t frequentWordCount = 0) const;
+        // Both return false if the vocabulary or the merge rules are cut short
+        bool load(const std::string filepath);
+        bool load(std::istream &inFile);
 
         bool operator==(const BPETokenizer<T>& other) const;
 
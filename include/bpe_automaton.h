@@ -0,0 +1,64 @@
+#ifndef BPE_AUTOMATON_H
+#define BPE_AUTOMATON_H
+
+#include <merge_table.h>
+#include <cstdint>
+#include <utility>
+#include <string_view>
+#include <vector>
+
+namespace dokusha
+{
+    // Linear-time exact BPE encoder compiled from a MergeTable.
+    //
+    // An Aho-Corasick automaton over the bytes of every token yields, after each input byte, all
+    // tokens ending at that byte, longest first. The last token of the encoding of every prefix is
+    // then the one candidate t whose pair with the last token of the prefix preceding t is one BPE
+    // itself would produce, which isValidTokenPair() checks by unwinding both tokens' merges. The
+    // encoding is read back from those last tokens, so a word costs O(n) automaton steps and pair
+    // checks bounded by the token length, instead of repeatedly searching for the next merge.
+    //
+    // This only matches merge replay when the rules are canonical: no two rules produce the same
+    // string and every token encodes to itself. compile() verifies both and fails otherwise.
+    class BPEAutomaton
+    {
+    public:
+        bool compile(const MergeTable &mergeTable);
+        bool isCompiledFor(size_t numRules) const { return this->compiled && this->numRules == numRules; }
+        // Heap bytes held by the compiled table
+        size_t memoryUsage() const;
+
+        // mergeTable must be the table the automaton was compiled from
+        void encodeWord(std::string_view word, const MergeTable &mergeTable, std::vector<unsigned short> &output) const;
+
+    private:
+        static constexpr uint32_t noToken = UINT32_MAX;
+        static constexpr uint64_t emptyKey = UINT64_MAX;
+
+        struct Edge
+        {
+            uint64_t key; // state << 8 | byte
+            uint32_t target;
+        };
+
+        size_t numRules = 0;
+        bool compiled = false;
+
+        std::vector<Edge> edges; // Open-addressing table of trie edges
+        uint64_t edgeMask = 0;
+        std::vector<uint32_t> failure;
+        std::vector<uint32_t> longestMatch;  // Longest token that is a suffix of the state's string
+        std::vector<uint32_t> tokenLength;
+        std::vector<uint32_t> nextShorter;   // Longest token that is a proper suffix of the token
+        std::vector<std::pair<uint32_t, uint32_t>> splits;
+        std::vector<unsigned short> outputIds;
+
+        size_t edgeIndex(uint64_t key) const { return ((key * 0x9E3779B97F4A7C15ull) >> 32) & this->edgeMask; }
+        uint32_t child(uint32_t state, unsigned char byte) const;
+        uint32_t addChild(uint32_t state, unsigned char byte);
+        uint32_t transition(uint32_t state, unsigned char byte) const;
+        bool isValidTokenPair(const MergeTable &mergeTable, uint32_t token1, uint32_t token2) const;
+    };
+}
+
+#endif
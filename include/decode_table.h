@@ -0,0 +1,48 @@
+#ifndef DECODE_TABLE_H
+#define DECODE_TABLE_H
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+namespace dokusha
+{
+    // Flat, read-only form of the inverse vocabulary used for decoding. The bytes of every token are
+    // stored back to back in one arena, indexed by token ID through flat offset and length arrays, so
+    // decoding needs no hashing. A sequence is decoded by first summing the lengths of its tokens to
+    // size the output exactly and then copying each token with 16-byte stores. The stores may run
+    // past the end of a token; the next token overwrites the excess, and both the arena and the
+    // output carry 16 bytes of padding so the last one stays in bounds.
+    class DecodeTable
+    {
+    public:
+        static constexpr size_t padding = 16;
+
+        void build(const std::unordered_map<unsigned short, std::string> &inverseVocabulary,
+                   const std::unordered_map<unsigned short, std::string> &specialTokens);
+        // numTokens counts the vocabulary and the special tokens
+        bool isCompiledFor(size_t numTokens) const { return this->compiled && this->numTokens == numTokens; }
+        // Heap bytes held by the compiled table
+        size_t memoryUsage() const;
+
+        // Unknown IDs decode to nothing
+        std::string_view token(unsigned short tokenId) const
+        {
+            return tokenId < this->lengths.size() ? std::string_view(this->arena.data() + this->offsets[tokenId], this->lengths[tokenId]) : std::string_view();
+        }
+        size_t decodedLength(const unsigned short *tokens, size_t numTokens) const;
+        // Appends the bytes of the tokens to output
+        void decode(const unsigned short *tokens, size_t numTokens, std::string &output) const;
+
+    private:
+        std::vector<char> arena;
+        std::vector<uint32_t> offsets;
+        std::vector<uint32_t> lengths;
+        size_t numTokens = 0;
+        bool compiled = false;
+    };
+}
+
+#endif
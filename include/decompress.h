@@ -0,0 +1,50 @@
+#ifndef DECOMPRESS_H
+#define DECOMPRESS_H
+
+#include <queue.h>
+#include <exception>
+#include <string>
+#include <thread>
+
+namespace dokusha
+{
+    enum class Compression
+    {
+        None,
+        Gzip,
+        Zstd
+    };
+
+    // Picks the codec from the file extension: .gz for gzip, .zst/.zstd for zstd
+    Compression detectCompression(const std::string &path);
+
+    // Streams the contents of a possibly compressed file. Decompression runs on a thread of its
+    // own and hands blocks of decompressed bytes over a bounded queue, so a corpus can be read
+    // without first being inflated to disk. Zstd input needs a build with DOKUSHA_WITH_ZSTD.
+    // Errors raised by the decompression thread are rethrown by readBlock() and getline().
+    class DecompressingReader
+    {
+    private:
+        BoundedQueue<std::string> blocks;
+        std::thread worker;
+        std::exception_ptr error;
+        std::string current;
+        size_t position;
+
+        void run(const std::string path, Compression compression, size_t blockSize);
+
+    public:
+        DecompressingReader(const std::string &path, size_t blockSize = 1 << 20, size_t queueCapacity = 8);
+        ~DecompressingReader();
+
+        DecompressingReader(const DecompressingReader &) = delete;
+        DecompressingReader &operator=(const DecompressingReader &) = delete;
+
+        // Returns the next block of decompressed bytes, or false at the end of the file
+        bool readBlock(std::string &block);
+        // Returns the next line without its trailing newline, or false at the end of the file
+        bool getline(std::string &line);
+    };
+}
+
+#endif
@@ -0,0 +1,51 @@
+#ifndef DOKUSHA_H
+#define DOKUSHA_H
+
+/*
+ * C interface to the tokenizer, for embedding it in programs written in other languages.
+ *
+ * A loaded tokenizer is read-only, so one handle can be shared by any number of threads. No function
+ * throws or allocates memory owned by the caller: encode and decode write into buffers supplied by the
+ * caller and return the size the complete result needs, so a result that did not fit can be retried
+ * with a larger buffer.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+    typedef struct dokusha_tokenizer dokusha_tokenizer;
+
+    /* Both return NULL if the tokenizer cannot be read */
+    dokusha_tokenizer *dokusha_load(const char *path);
+    dokusha_tokenizer *dokusha_load_from_memory(const void *data, size_t size);
+    void dokusha_free(dokusha_tokenizer *tokenizer);
+
+    /* Writes up to capacity token IDs of text and returns the number of tokens of the whole text */
+    size_t dokusha_encode(const dokusha_tokenizer *tokenizer, const char *text, size_t length, uint16_t *tokens, size_t capacity);
+
+    /* Writes up to capacity bytes of the decoded tokens, without a terminating NUL, and returns the length of the
+     * whole decoded text */
+    size_t dokusha_decode(const dokusha_tokenizer *tokenizer, const uint16_t *tokens, size_t count, char *text, size_t capacity);
+
+    /* A tokenizer trained to a large vocabulary also serves every smaller one it passed during training: encoding
+     * with only its first merge_limit merge rules gives the output of the tokenizer trained to that point. */
+    size_t dokusha_merge_count(const dokusha_tokenizer *tokenizer);
+    size_t dokusha_encode_with_merge_limit(const dokusha_tokenizer *tokenizer, const char *text, size_t length, uint16_t *tokens,
+                                           size_t capacity, size_t merge_limit);
+
+    /* Like dokusha_decode, but returns DOKUSHA_INVALID_TOKENS without writing anything if a token ID is not in the
+     * vocabulary of the first merge_limit merge rules and not a special token */
+#define DOKUSHA_INVALID_TOKENS SIZE_MAX
+    size_t dokusha_decode_with_merge_limit(const dokusha_tokenizer *tokenizer, const uint16_t *tokens, size_t count, char *text,
+                                           size_t capacity, size_t merge_limit);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
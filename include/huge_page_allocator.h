@@ -0,0 +1,76 @@
+#ifndef HUGE_PAGE_ALLOCATOR_H
+#define HUGE_PAGE_ALLOCATOR_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+namespace dokusha
+{
+    // How the memory of the large training tables is backed
+    enum class HugePageMode
+    {
+        Off,         // Plain operator new
+        Transparent, // Regions advised with madvise(MADV_HUGEPAGE), for the kernel's transparent huge pages
+        HugeTLB      // Regions mapped with MAP_HUGETLB from the reserved pool, else as Transparent
+    };
+
+    // Allocation behind HugePageAllocator. Blocks of up to 512 bytes, the nodes of the hash tables, are carved
+    // from 16 MB regions that every thread maps for itself; blocks of 2 MB and more, such as large bucket arrays,
+    // get a region of their own; everything in between comes from operator new. Every region falls back from
+    // MAP_HUGETLB to transparent huge pages to regular pages, whichever the kernel grants first.
+    //
+    // The small block regions form an arena that only grows: a freed small block goes onto the free list of the
+    // thread that frees it, not back to the region it came from, and the regions are only returned to the system
+    // at exit. Blocks freed on another thread than the one that allocated them, such as a table built by workers
+    // and destroyed by the main thread, therefore move to that thread's lists along with their NUMA node, and a
+    // table that shrinks keeps its peak footprint mapped. This suits the training tables, which are filled once,
+    // used by the threads that filled them and dropped at the end; the large regions are unmapped when freed.
+    namespace hugepages
+    {
+        // The mode is fixed by the first allocation: until then setMode may change it and returns true, after that
+        // it only returns whether the mode in effect is the requested one. Without setMode the mode is taken from
+        // the environment variable DOKUSHA_HUGE_PAGES (off, thp or hugetlb) and is Off if that is not set.
+        bool setMode(HugePageMode mode);
+        HugePageMode mode();
+        HugePageMode parseMode(const std::string &name, HugePageMode fallback);
+        const char *modeName(HugePageMode mode);
+
+        // Bytes of the regions currently mapped, by the backing the kernel granted
+        struct Usage
+        {
+            uint64_t hugeTlbBytes = 0;
+            uint64_t transparentBytes = 0; // Advised; how much the kernel actually collapsed shows in AnonHugePages
+            uint64_t regularBytes = 0;
+        };
+        Usage usage();
+        std::string toJson();
+
+        void *allocate(size_t bytes);
+        void deallocate(void *pointer, size_t bytes);
+        // Bytes set aside for a block of the given size: a 16 byte size class, a malloc chunk or whole huge pages
+        size_t blockBytes(size_t bytes);
+    }
+
+    // Stateless allocator for standard containers, see hugepages
+    template <typename T>
+    class HugePageAllocator
+    {
+    public:
+        using value_type = T;
+        static_assert(alignof(T) <= 16, "HugePageAllocator hands out 16 byte aligned blocks");
+
+        HugePageAllocator() = default;
+        template <typename U>
+        HugePageAllocator(const HugePageAllocator<U> &) {}
+
+        T *allocate(size_t count) { return static_cast<T *>(hugepages::allocate(count * sizeof(T))); }
+        void deallocate(T *pointer, size_t count) { hugepages::deallocate(pointer, count * sizeof(T)); }
+        static size_t blockBytes(size_t bytes) { return hugepages::blockBytes(bytes); }
+
+        template <typename U>
+        bool operator==(const HugePageAllocator<U> &) const { return true; }
+    };
+}
+
+#endif
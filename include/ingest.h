@@ -0,0 +1,48 @@
+#ifndef INGEST_H
+#define INGEST_H
+
+#include <bpe.h>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace dokusha
+{
+    // A newline-aligned byte range of a corpus file, the unit of work handed to one ingestion thread
+    struct CorpusChunk
+    {
+        std::string path;
+        uint64_t begin;
+        uint64_t end;
+        unsigned skipLines; // Header lines to drop, only non-zero for the chunk starting the file
+    };
+
+    struct IngestWorkerStats
+    {
+        unsigned chunks = 0;
+        uint64_t bytes = 0;
+        uint64_t lines = 0;
+        double seconds = 0;
+        std::vector<std::string> errors; // One message naming the file for every chunk that failed, partly ingested or not at all
+    };
+
+    // Enumerates every file under corpusPath up front and splits files larger than chunkSize at
+    // newline boundaries. Chunks are returned largest first, so that handing them out in order to
+    // whichever thread is idle keeps a few very large files from serialising the run. Gzip and
+    // zstd files are streamed through a DecompressingReader instead and always form one chunk.
+    std::vector<CorpusChunk> planCorpusChunks(const std::string &corpusPath, uint64_t chunkSize, unsigned skipLines);
+
+    // Ingests a corpus on all OpenMP threads. Every thread fills its own word table, and the tables
+    // are folded into tokenizer once all chunks are done. Returns the statistics of every thread.
+    // A chunk that cannot be read, such as a corrupt gzip file or a zstd file in a build without
+    // zstd, does not stop the others: its error is recorded in the stats of the thread that read it,
+    // and the caller decides whether the corpus is still usable (see ingestFailed).
+    std::vector<IngestWorkerStats> ingestCorpus(const std::string &corpusPath, BPETokenizer<std::string> &tokenizer,
+                                                unsigned skipLines = 2, uint64_t chunkSize = 64ull << 20);
+
+    bool ingestFailed(const std::vector<IngestWorkerStats> &workerStats);
+    // Also lists every chunk error
+    void printIngestStats(const std::vector<IngestWorkerStats> &workerStats);
+}
+
+#endif
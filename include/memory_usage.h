@@ -0,0 +1,182 @@
+#ifndef MEMORY_USAGE_H
+#define MEMORY_USAGE_H
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <type_traits>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+namespace dokusha
+{
+    // Heap bytes owned by a structure, and how many elements it holds
+    struct StructureMemory
+    {
+        std::string name;
+        size_t elements;
+        size_t bytes;
+    };
+
+    struct MemoryUsage
+    {
+        std::vector<StructureMemory> structures;
+
+        size_t totalBytes() const;
+        // Also reports the live and peak bytes of the counting allocator when it is compiled in, and the bytes
+        // mapped for HugePageAllocator when huge pages are on. Those regions keep freed blocks for reuse, so they
+        // can exceed the blocks in use that the structures count.
+        std::string toJson() const;
+    };
+
+    // Largest footprint seen for every structure and for the total over a series of reports, such as
+    // one per training iteration. The structures peak at different times, so their peaks need not sum
+    // to the peak total.
+    class MemoryPeak
+    {
+    public:
+        void update(const MemoryUsage &usage);
+        std::string toJson() const;
+
+    private:
+        MemoryUsage peaks;
+        size_t totalBytes = 0;
+        size_t updates = 0;
+        size_t totalUpdate = 0; // The update at which the total peaked, counting from 1
+    };
+
+    // Estimates of the heap bytes behind standard containers as libstdc++ and glibc lay them out: every
+    // allocation is rounded up to a malloc chunk, strings allocate only beyond their 15 inline bytes, and
+    // every element of a hash container is a node of its own holding the next pointer, the value and,
+    // for hashes that are not trivially cheap, the cached hash code. Containers whose allocator has a
+    // static blockBytes(size), such as HugePageAllocator, are rounded the way that allocator rounds.
+    namespace memory
+    {
+        constexpr size_t mallocChunk(size_t size)
+        {
+            return size == 0 ? 0 : std::max<size_t>(32, (size + sizeof(size_t) + 15) & ~size_t(15));
+        }
+
+        template <typename Allocator>
+        size_t allocationBytes(size_t size)
+        {
+            if constexpr (requires { Allocator::blockBytes(size); })
+            {
+                return Allocator::blockBytes(size);
+            }
+            else
+            {
+                return mallocChunk(size);
+            }
+        }
+
+        inline size_t heapBytes(const std::string &value)
+        {
+            return value.capacity() > 15 ? mallocChunk(value.capacity() + 1) : 0;
+        }
+
+        template <typename T>
+            requires std::is_trivially_copyable_v<T>
+        size_t heapBytes(const T &)
+        {
+            return 0;
+        }
+
+        template <typename T1, typename T2>
+        size_t heapBytes(const std::pair<T1, T2> &value);
+        template <typename Key, typename Value, typename Hash, typename Equal, typename Allocator>
+        size_t heapBytes(const std::unordered_map<Key, Value, Hash, Equal, Allocator> &map);
+        template <typename Key, typename Hash, typename Equal, typename Allocator>
+        size_t heapBytes(const std::unordered_set<Key, Hash, Equal, Allocator> &set);
+
+        template <typename T, typename Allocator>
+        size_t heapBytes(const std::vector<T, Allocator> &values)
+        {
+            size_t bytes = allocationBytes<Allocator>(values.capacity() * sizeof(T));
+            if constexpr (!std::is_trivially_copyable_v<T>)
+            {
+                for (const auto &value : values)
+                {
+                    bytes += heapBytes(value);
+                }
+            }
+            return bytes;
+        }
+
+        template <typename T1, typename T2>
+        size_t heapBytes(const std::pair<T1, T2> &value)
+        {
+            return heapBytes(value.first) + heapBytes(value.second);
+        }
+
+        template <typename Key, typename Value, typename Hash>
+        constexpr size_t hashNodeSize()
+        {
+#ifdef __GLIBCXX__
+            constexpr bool cachesHash = std::__cache_default<Key, Hash>::value;
+#else
+            constexpr bool cachesHash = true;
+#endif
+            struct Node
+            {
+                void *next;
+                Value value;
+            };
+            struct NodeWithHash
+            {
+                void *next;
+                Value value;
+                size_t hash;
+            };
+            return sizeof(std::conditional_t<cachesHash, NodeWithHash, Node>);
+        }
+
+        template <typename Container>
+        size_t hashTableBytes(const Container &container)
+        {
+            using Value = typename Container::value_type;
+            using Allocator = typename Container::allocator_type;
+            size_t bytes = container.bucket_count() > 1 ? allocationBytes<Allocator>(container.bucket_count() * sizeof(void *)) : 0;
+            bytes += container.size() * allocationBytes<Allocator>(hashNodeSize<typename Container::key_type, Value, typename Container::hasher>());
+            if constexpr (!std::is_trivially_copyable_v<Value>)
+            {
+                for (const auto &value : container)
+                {
+                    bytes += heapBytes(value);
+                }
+            }
+            return bytes;
+        }
+
+        template <typename Key, typename Value, typename Hash, typename Equal, typename Allocator>
+        size_t heapBytes(const std::unordered_map<Key, Value, Hash, Equal, Allocator> &map)
+        {
+            return hashTableBytes(map);
+        }
+
+        template <typename Key, typename Hash, typename Equal, typename Allocator>
+        size_t heapBytes(const std::unordered_set<Key, Hash, Equal, Allocator> &set)
+        {
+            return hashTableBytes(set);
+        }
+
+        template <typename Container>
+        StructureMemory structure(const std::string &name, const Container &container)
+        {
+            return StructureMemory{name, container.size(), heapBytes(container)};
+        }
+
+        // Exact bytes allocated through operator new and not yet freed, and the most there ever were since the
+        // last resetPeak(). Both stay 0 unless the library is built with DOKUSHA_COUNT_ALLOCATIONS, which
+        // replaces the global operator new and delete of the whole process with counting versions.
+        bool countingAllocatorEnabled();
+        uint64_t allocatedBytes();
+        uint64_t peakAllocatedBytes();
+        void resetPeak();
+    }
+}
+
+#endif
@@ -0,0 +1,103 @@
+#ifndef MERGE_TABLE_H
+#define MERGE_TABLE_H
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace dokusha
+{
+    // Flat, read-only form of the ranked merge rules used for encoding. Tokens are renumbered into a
+    // dense internal space (0-255 for the raw bytes, then merged tokens in the order they are first
+    // produced) and every rule is stored in one open-addressing table keyed by its internal token
+    // pair, so looking up a pair costs one probe into a contiguous array instead of hashing strings.
+    //
+    // Words are encoded by repeatedly merging the leftmost adjacent pair with the lowest rank that is
+    // not below the rank of the previous merge. That is exactly what replaying the rules in order does.
+    class MergeTable
+    {
+    public:
+        static constexpr uint32_t noRank = UINT32_MAX;
+
+        // Returns false, leaving the table uncompiled, if a rule uses a token no earlier rule produces
+        bool build(const std::vector<std::pair<std::pair<std::string, std::string>, std::string>> &rankedMergeRules,
+                   const std::unordered_map<std::string, unsigned short> &vocabulary);
+        bool isCompiledFor(size_t numRules) const { return this->compiled && this->numRules == numRules; }
+        // Heap bytes held by the compiled table
+        size_t memoryUsage() const;
+
+        // Only rules ranked below mergeLimit are applied, which encodes like the tokenizer training had
+        // produced after learning mergeLimit rules
+        void encodeWord(std::string_view word, std::vector<unsigned short> &output, uint32_t mergeLimit = noRank) const;
+        // Same as encodeWord, but yields internal tokens
+        void encodeWordInternal(std::string_view word, std::vector<uint32_t> &output) const;
+
+        // Encodes many words, advancing groupSize of them in lockstep. Each round first prefetches the
+        // table slot of every pending pair lookup of every word in the group and only then resolves
+        // them, so the cache misses of different words overlap instead of being paid one after another.
+        // The tokens of word i end up in tokens[spans[i].first, spans[i].first + spans[i].second).
+        void encodeWords(const std::vector<std::string_view> &words, std::vector<unsigned short> &tokens,
+                         std::vector<std::pair<size_t, size_t>> &spans, size_t groupSize = 16) const;
+
+        // Internal token space, for structures compiled on top of this table
+        size_t tokenCount() const { return this->tokenStrings.size(); }
+        size_t ruleCount() const { return this->numRules; }
+        const std::string &tokenString(uint32_t token) const { return this->tokenStrings[token]; }
+        // Pair merged by the first rule producing token, or (token, token) for a raw byte
+        std::pair<uint32_t, uint32_t> split(uint32_t token) const { return this->splits[token]; }
+        unsigned short outputId(uint32_t token) const { return this->outputIds[token]; }
+        // Rank of the rule merging (left, right) and the token it produces, or noRank
+        uint32_t lookup(uint32_t left, uint32_t right, uint32_t &merged) const
+        {
+            const Slot *slot = this->find(left, right);
+            merged = slot == nullptr ? 0 : slot->merged;
+            return slot == nullptr ? noRank : slot->rank;
+        }
+
+    private:
+        struct Slot
+        {
+            uint64_t key;
+            uint32_t rank;
+            uint32_t merged;
+        };
+
+        // Merge state of one word, shared by the scalar and the interleaved encoders
+        struct WordState
+        {
+            std::vector<uint32_t> tokens;
+            std::vector<uint32_t> ranks;  // ranks[i] belongs to the pair (tokens[i], tokens[i + 1])
+            std::vector<uint32_t> merges; // Token produced by merging that pair
+            std::vector<size_t> pending;  // Pairs whose rank still has to be looked up
+            uint32_t floor;
+            size_t word;
+
+            uint32_t limit; // Rules of this rank and above are not applied
+
+            void start(std::string_view text, size_t wordIndex, uint32_t mergeLimit = noRank);
+        };
+
+        static constexpr uint64_t emptyKey = UINT64_MAX;
+
+        std::vector<Slot> slots;
+        uint64_t mask = 0;
+        std::vector<unsigned short> outputIds; // Internal token -> vocabulary ID
+        std::vector<std::string> tokenStrings;
+        std::vector<std::pair<uint32_t, uint32_t>> splits;
+        size_t numRules = 0;
+        bool compiled = false;
+
+        static uint64_t pairKey(uint32_t left, uint32_t right) { return (static_cast<uint64_t>(left) << 32) | right; }
+        size_t slotIndex(uint64_t key) const { return ((key * 0x9E3779B97F4A7C15ull) >> 32) & this->mask; }
+
+        const Slot *find(uint32_t left, uint32_t right) const;
+        void prefetch(uint32_t left, uint32_t right) const;
+        void resolve(WordState &state) const;
+        bool step(WordState &state) const;
+    };
+}
+
+#endif
@@ -0,0 +1,53 @@
+#ifndef MULTIPROCESS_TRAINING_H
+#define MULTIPROCESS_TRAINING_H
+
+#include <bpe.h>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+
+namespace dokusha
+{
+    struct MultiProcessTrainingOptions
+    {
+        unsigned workers = 4;
+        size_t exchangeCapacity = 1 << 20; // Pair count deltas a worker hands over per exchange round
+        unsigned skipLines = 2;
+        uint64_t chunkSize = 64ull << 20;
+    };
+
+    struct MultiProcessTrainingStats
+    {
+        unsigned workers = 0;
+        uint64_t words = 0;          // Distinct words after pruning, summed over the partitions
+        uint64_t merges = 0;
+        uint64_t exchangedDeltas = 0; // Pair count deltas reduced by the coordinator
+        uint64_t exchangeRounds = 0;
+        double ingestSeconds = 0;
+        double trainSeconds = 0;
+        std::vector<unsigned short> unreachedSizes; // Of vocabularySizes, those not reached when the pairs ran out
+    };
+
+    // Trains tokenizer on a corpus whose word table is split over options.workers forked processes.
+    //
+    // Every worker ingests the corpus keeping only the words hashing to its partition (see
+    // BPETokenizer::setWordPartition), prunes them and holds them as token ID sequences. The calling
+    // process becomes the coordinator and never sees a word: it holds the global pair counts, which the
+    // workers keep up to date by sending the changes their merges cause, first their full counts and then
+    // only the deltas of the words each merge touched. The deltas go through a shared memory segment in
+    // rounds of at most exchangeCapacity entries per worker, separated by barriers; the coordinator then
+    // picks the most frequent pair, breaking ties by the smaller token IDs, learns it and broadcasts it.
+    //
+    // Training stops at the largest of vocabularySizes or when no pair is left. onVocabularySize is called
+    // in the coordinator whenever one of the sizes is reached, with the tokenizer holding the merges so far;
+    // the sizes still ahead when no pair is left are never passed to it and are listed in stats.unreachedSizes.
+    // The coordinator checks on the workers while it waits and the workers on the coordinator, so the death
+    // of any process ends training: false is returned and the remaining workers are killed. Must be called
+    // before the process runs any OpenMP parallel region, as libgomp does not survive fork() after one.
+    bool trainMultiProcess(const std::string &corpusPath, BPETokenizer<std::string> &tokenizer,
+                           const std::vector<unsigned short> &vocabularySizes, const MultiProcessTrainingOptions &options,
+                           const std::function<void(unsigned short)> &onVocabularySize, MultiProcessTrainingStats &stats);
+}
+
+#endif
@@ -0,0 +1,64 @@
+#ifndef NUMA_TOPOLOGY_H
+#define NUMA_TOPOLOGY_H
+
+#include <sched.h>
+#include <string>
+#include <vector>
+
+namespace dokusha
+{
+    struct NumaNode
+    {
+        int id;
+        std::vector<int> cpus; // Only those this process may run on
+    };
+
+    // Where one thread of a parallel team runs
+    struct ThreadPlacement
+    {
+        int node; // Index into NumaTopology::nodes()
+        int cpu;
+        bool nodeLeader; // First thread of its node, which reduces the node's partial results
+    };
+
+    class NumaTopology
+    {
+    public:
+        // Read once per process: the NUMA nodes from libnuma when the library was built with it (DOKUSHA_WITH_NUMA)
+        // and the kernel reports NUMA, otherwise a single node holding every CPU of the process affinity mask
+        static const NumaTopology &system();
+
+        const std::vector<NumaNode> &nodes() const { return this->nodeList; }
+        // "libnuma" or "affinity", whichever the nodes came from
+        const std::string &source() const { return this->origin; }
+
+        // Spreads numThreads over the CPUs in node order, so consecutive threads share a node and every node gets
+        // threads in proportion to its CPUs. CPUs are shared only when there are more threads than CPUs.
+        std::vector<ThreadPlacement> place(int numThreads) const;
+        std::string toJson(const std::vector<ThreadPlacement> &placements) const;
+
+    private:
+        std::vector<NumaNode> nodeList;
+        std::string origin;
+    };
+
+    // Restricts the calling thread to one CPU; false if the kernel refused
+    bool pinCurrentThread(int cpu);
+
+    // Restores the CPU affinity the calling thread had at construction, so that pinning the thread that starts
+    // a parallel region does not carry over to its later work or to the threads it creates
+    class ScopedAffinity
+    {
+    public:
+        ScopedAffinity();
+        ~ScopedAffinity();
+        ScopedAffinity(const ScopedAffinity &) = delete;
+        ScopedAffinity &operator=(const ScopedAffinity &) = delete;
+
+    private:
+        cpu_set_t saved;
+        bool valid;
+    };
+}
+
+#endif
@@ -0,0 +1,86 @@
+#ifndef PIPELINE_H
+#define PIPELINE_H
+
+#include <bpe.h>
+#include <queue.h>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace dokusha
+{
+    struct EncodePipelineOptions
+    {
+        std::string outputDirectory = ".";
+        size_t blockSize = 4 << 20;          // Bytes handed from the reader to the pre-tokenizers at once
+        unsigned splitterThreads = 1;
+        unsigned encoderThreads = 1;
+        size_t queueCapacity = 16;           // Blocks in flight between two stages
+        unsigned tokenWidth = 2;             // Bytes per token in the shards, 2 (uint16) or 4 (uint32)
+        uint64_t shardTokens = 1ull << 28;   // A shard is closed at the first document boundary past this
+    };
+
+    struct EncodePipelineStats
+    {
+        uint64_t bytesRead = 0;
+        uint64_t documents = 0;
+        uint64_t tokens = 0;
+        unsigned shards = 0;
+        double seconds = 0;
+    };
+
+    // Encodes a corpus into token shards with four stages connected by bounded queues:
+    //
+    //   reader -> line splitters -> encoders -> writer
+    //
+    // The reader cuts files into newline-aligned blocks, every line being one document.
+    // Line splitters and encoders run on their own thread pools, and the writer restores
+    // the input order before appending to the current shard. Every line is encoded like tokenize() encodes it,
+    // special tokens included. Each shard is a flat array of
+    // little-endian tokens (shard_NNNNN.bin) next to a document index (shard_NNNNN.idx):
+    //
+    //   uint32 tokenWidth, uint64 documentCount, uint64 offsets[documentCount + 1]
+    //
+    // where offsets are counted in tokens from the start of the shard. Every input line is a
+    // document, an empty line one of 0 tokens. run() rethrows the first error of any stage,
+    // such as an input that cannot be opened or a shard that cannot be written, after
+    // stopping the others.
+    class EncodePipeline
+    {
+    private:
+        struct TextBlock
+        {
+            size_t sequence;
+            std::string text;
+        };
+
+        // The text of a block with the end offset of every line in it, so lines reach the encoders without copies
+        struct LineBlock
+        {
+            size_t sequence;
+            std::string text;
+            std::vector<size_t> lineEnds;
+        };
+
+        struct TokenBlock
+        {
+            size_t sequence;
+            std::vector<unsigned short> tokens;
+            std::vector<uint64_t> documentLengths;
+        };
+
+        const BPETokenizer<std::string> &tokenizer;
+        EncodePipelineOptions options;
+
+        void readStage(const std::vector<std::string> &inputFiles, BoundedQueue<TextBlock> &output, EncodePipelineStats &stats);
+        void splitLinesStage(BoundedQueue<TextBlock> &input, BoundedQueue<LineBlock> &output);
+        void encodeStage(BoundedQueue<LineBlock> &input, BoundedQueue<TokenBlock> &output);
+        void writeStage(BoundedQueue<TokenBlock> &input, EncodePipelineStats &stats);
+
+    public:
+        EncodePipeline(const BPETokenizer<std::string> &tokenizer, EncodePipelineOptions options);
+        EncodePipelineStats run(const std::vector<std::string> &inputFiles);
+    };
+}
+
+#endif
@@ -0,0 +1,96 @@
+#ifndef QUEUE_H
+#define QUEUE_H
+
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <optional>
+
+namespace dokusha
+{
+    // Blocking multi-producer/multi-consumer queue with a fixed capacity.
+    // Producers block while the queue is full, which keeps a fast stage from
+    // running arbitrarily far ahead of a slow one. Once close() is called,
+    // pop() drains the remaining items and then returns std::nullopt.
+    template <typename T>
+    class BoundedQueue
+    {
+    private:
+        std::deque<T> items;
+        size_t capacity;
+        bool closed;
+        std::mutex mutex;
+        std::condition_variable notFull;
+        std::condition_variable notEmpty;
+
+    public:
+        explicit BoundedQueue(size_t capacity) : capacity(capacity), closed(false) {}
+
+        bool push(T item)
+        {
+            std::unique_lock<std::mutex> lock(this->mutex);
+            this->notFull.wait(lock, [this]
+                               { return this->closed || this->items.size() < this->capacity; });
+            if (this->closed)
+            {
+                return false;
+            }
+            this->items.push_back(std::move(item));
+            lock.unlock();
+            this->notEmpty.notify_one();
+            return true;
+        }
+
+        std::optional<T> pop()
+        {
+            std::unique_lock<std::mutex> lock(this->mutex);
+            this->notEmpty.wait(lock, [this]
+                                { return this->closed || !this->items.empty(); });
+            if (this->items.empty())
+            {
+                return std::nullopt;
+            }
+            T item = std::move(this->items.front());
+            this->items.pop_front();
+            lock.unlock();
+            this->notFull.notify_one();
+            return item;
+        }
+
+        // Like pop(), but also gives up and returns std::nullopt once deadline has passed
+        std::optional<T> popUntil(std::chrono::steady_clock::time_point deadline)
+        {
+            std::unique_lock<std::mutex> lock(this->mutex);
+            this->notEmpty.wait_until(lock, deadline, [this]
+                                      { return this->closed || !this->items.empty(); });
+            if (this->items.empty())
+            {
+                return std::nullopt;
+            }
+            T item = std::move(this->items.front());
+            this->items.pop_front();
+            lock.unlock();
+            this->notFull.notify_one();
+            return item;
+        }
+
+        void close()
+        {
+            {
+                std::lock_guard<std::mutex> lock(this->mutex);
+                this->closed = true;
+            }
+            this->notFull.notify_all();
+            this->notEmpty.notify_all();
+        }
+
+        size_t size()
+        {
+            std::lock_guard<std::mutex> lock(this->mutex);
+            return this->items.size();
+        }
+    };
+}
+
+#endif
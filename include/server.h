@@ -0,0 +1,104 @@
+#ifndef SERVER_H
+#define SERVER_H
+
+#include <queue.h>
+#include <tokenizer_handle.h>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <future>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+namespace dokusha
+{
+    struct ServerOptions
+    {
+        std::string socketPath;
+        unsigned encoderThreads = 1;
+        size_t maxBatch = 64;                    // Encode requests handed to tokenizeBatch at once
+        std::chrono::microseconds batchDelay{20}; // How long a batch waits for more requests after its first one
+        size_t queueCapacity = 4096;
+        uint32_t maxPayload = 64u << 20;         // Larger requests close the connection
+    };
+
+    // Power-of-two buckets, bucket i counting values in [2^(i-1), 2^i)
+    class Histogram
+    {
+    public:
+        void record(uint64_t value);
+        std::string toJson() const;
+
+    private:
+        std::array<std::atomic<uint64_t>, 40> buckets{};
+    };
+
+    // Serves a frozen tokenizer to local processes over a Unix domain socket.
+    //
+    // Every request is a header of a uint8 opcode and a uint32 payload size, followed by the payload,
+    // and is answered with a uint32 size and the response payload, all in host byte order:
+    //
+    //   encode (1): UTF-8 text            -> uint16 token IDs
+    //   decode (2): uint16 token IDs      -> text
+    //   stats  (3): empty                 -> JSON document of the counters and histograms
+    //
+    // A connection is served by a thread of its own, one request at a time. Encode requests of all
+    // connections go through one queue, from which the encoder threads take micro-batches of up to
+    // maxBatch requests, waiting at most batchDelay after the first, and encode each with a single
+    // tokenizeBatch call. Decoding is cheap enough to be answered directly. Every batch and every decode
+    // uses the tokenizer current when it starts, so the handle can be reloaded while serving.
+    class TokenizerServer
+    {
+    public:
+        TokenizerServer(const TokenizerHandle &tokenizers, const ServerOptions &options);
+        ~TokenizerServer();
+
+        // Listens until stop() is called, throws std::runtime_error if the socket cannot be set up
+        void run();
+        void stop();
+        std::string statsJson() const;
+
+        static constexpr uint8_t encodeOp = 1;
+        static constexpr uint8_t decodeOp = 2;
+        static constexpr uint8_t statsOp = 3;
+
+    private:
+        struct EncodeRequest
+        {
+            std::string text;
+            std::promise<std::vector<unsigned short>> result;
+            std::chrono::steady_clock::time_point enqueued;
+        };
+
+        const TokenizerHandle &tokenizers;
+        ServerOptions options;
+        BoundedQueue<EncodeRequest> requests;
+        std::atomic<bool> stopping{false};
+        std::atomic<int> listenFd{-1}; // Read by stop() from any thread
+
+        // Connection threads by connection number. A thread adds its number to finishedConnections as it exits,
+        // and run() joins the finished ones whenever it accepts a connection, so the table only holds live ones.
+        std::mutex connectionsMutex;
+        std::vector<int> connectionFds;
+        std::unordered_map<uint64_t, std::thread> connectionThreads;
+        std::vector<uint64_t> finishedConnections;
+
+        std::atomic<uint64_t> connections{0};
+        std::atomic<uint64_t> encodeRequests{0};
+        std::atomic<uint64_t> decodeRequests{0};
+        std::atomic<uint64_t> batches{0};
+        Histogram queueDepth;     // Requests still queued when a batch is formed
+        Histogram batchSize;
+        Histogram latencyMicros;  // From enqueueing an encode request to its tokens being ready
+
+        void encodeLoop();
+        void serveConnection(int fd, uint64_t connection);
+        void joinFinishedConnections();
+    };
+}
+
+#endif
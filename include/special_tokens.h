@@ -0,0 +1,57 @@
+#ifndef SPECIAL_TOKENS_H
+#define SPECIAL_TOKENS_H
+
+#include <array>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+namespace dokusha
+{
+    // Registry of special tokens such as <|endoftext|>, which are matched verbatim in the input and
+    // encoded to their reserved ID instead of going through the merge rules.
+    //
+    // find() first skips ahead to bytes that can start a special token, comparing 16 input bytes at a
+    // time against every distinct first byte with SSE2 when there are at most maxVectorFirstBytes of
+    // them, and then verifies each candidate by walking a trie of all special tokens, taking the
+    // longest match. Inputs without special tokens are scanned at close to memchr speed.
+    class SpecialTokens
+    {
+    public:
+        static constexpr size_t npos = std::string_view::npos;
+
+        // Fails for an empty token, a token containing a space or newline (those always separate words),
+        // and a token or ID that is already registered
+        bool add(const std::string &token, unsigned short tokenId);
+        bool empty() const { return this->tokensById.empty(); }
+        size_t size() const { return this->tokensById.size(); }
+        const std::unordered_map<unsigned short, std::string> &tokens() const { return this->tokensById; }
+        // Heap bytes of the registry and the trie
+        size_t memoryUsage() const;
+
+        // Position of the first special token at or after from, or npos
+        size_t find(std::string_view text, size_t from, size_t &length, unsigned short &tokenId) const;
+
+    private:
+        static constexpr size_t maxVectorFirstBytes = 4;
+
+        struct TrieNode
+        {
+            std::vector<std::pair<unsigned char, uint32_t>> children;
+            int32_t tokenId = -1;
+        };
+
+        std::unordered_map<unsigned short, std::string> tokensById;
+        std::unordered_map<std::string, unsigned short> idsByToken;
+        std::vector<TrieNode> trie;
+        std::vector<unsigned char> firstBytes;
+        std::array<bool, 256> isFirstByte{};
+
+        size_t nextCandidate(std::string_view text, size_t from) const;
+        size_t matchAt(std::string_view text, size_t position, unsigned short &tokenId) const;
+    };
+}
+
+#endif
@@ -0,0 +1,72 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <chrono>
+#include <cstdint>
+#include <string>
+
+namespace dokusha::stats
+{
+    enum class Counter
+    {
+        IngestBytes,
+        IngestLines,
+        IngestWords,
+        Merges,
+        WordsTouched, // Words changed by a merge, summed over all merges
+        EncodeCalls,
+        EncodeBytes,
+        EncodeTokens,
+        DecodeCalls,
+        DecodeTokens,
+        DecodeBytes,
+        NumCounters
+    };
+
+    enum class Timer
+    {
+        PairCount,
+        BestPair,
+        MergeApplication,
+        PairReduction, // Folding per-thread pair counts into one table, see BPETokenizer::setNumaTraining
+        NumTimers
+    };
+
+    // Every thread counts into a block of its own, so updates are plain stores without any contention.
+    // The blocks are only summed when a snapshot is exported, which may race with updates and then
+    // reflect some of them but never tears a value. A thread's counts are folded into a shared total
+    // and its block is freed when it exits.
+    void add(Counter counter, uint64_t value);
+    void addTime(Timer timer, uint64_t nanoseconds);
+    uint64_t get(Counter counter);
+    void reset();
+    // Adds a JSON value to the export under name, replacing an earlier one of the same name; for decisions
+    // made at runtime such as the thread placement of training
+    void setSection(const std::string &name, const std::string &json);
+    // Counters, calls and total seconds of every timer, and the sections
+    std::string toJson();
+
+    class ScopedTimer
+    {
+    public:
+        explicit ScopedTimer(Timer timer) : timer(timer), start(std::chrono::steady_clock::now()) {}
+        ~ScopedTimer() { addTime(this->timer, std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - this->start).count()); }
+
+    private:
+        Timer timer;
+        std::chrono::steady_clock::time_point start;
+    };
+}
+
+// Instrumentation points compile to nothing unless DOKUSHA_STATS is defined (the CMake option of the same name)
+#ifdef DOKUSHA_STATS
+#define DOKUSHA_COUNT(counter, value) ::dokusha::stats::add(::dokusha::stats::Counter::counter, (value))
+#define DOKUSHA_TIME_CONCAT(name, line) name##line
+#define DOKUSHA_TIME_NAME(line) DOKUSHA_TIME_CONCAT(dokushaScopedTimer, line)
+#define DOKUSHA_TIME(timer) ::dokusha::stats::ScopedTimer DOKUSHA_TIME_NAME(__LINE__)(::dokusha::stats::Timer::timer)
+#else
+#define DOKUSHA_COUNT(counter, value) ((void)0)
+#define DOKUSHA_TIME(timer) ((void)0)
+#endif
+
+#endif
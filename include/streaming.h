@@ -0,0 +1,61 @@
+#ifndef STREAMING_H
+#define STREAMING_H
+
+#include <bpe.h>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace dokusha
+{
+    // Encodes text that arrives in arbitrary chunks. Tokens are appended to the caller's vector as soon
+    // as the word they belong to is complete, so memory stays bounded by the longest word and the
+    // longest run of whitespace instead of by the input size.
+    //
+    // Words are split exactly like tokenize() splits them: every space starts a new word, newlines stay
+    // inside words, and whitespace at the start and end of the stream is dropped. A whitespace run is
+    // held back until the next non-whitespace byte shows it is not trailing. The output matches
+    // tokenize() on the concatenated input whenever that input does not start with whitespace. Special
+    // tokens never contain whitespace, so each of them is always found within a single word.
+    class StreamingEncoder
+    {
+    public:
+        explicit StreamingEncoder(const BPETokenizer<std::string> &tokenizer) : tokenizer(tokenizer) {}
+
+        void feed(std::string_view chunk, std::vector<unsigned short> &output);
+        // Flushes the last word and resets the encoder for a new stream
+        void finish(std::vector<unsigned short> &output);
+
+    private:
+        const BPETokenizer<std::string> &tokenizer;
+        std::string word;              // Current word, not yet known to be complete
+        std::string pendingWhitespace; // Whitespace after word, which may still turn out to be trailing
+        bool started = false;          // Whether a non-whitespace byte has been seen
+
+        void flushWhitespace(std::vector<unsigned short> &output);
+    };
+
+    // Decodes token IDs one at a time, as they are generated. Token bytes may end in the middle of a
+    // multi-byte UTF-8 character, so push() only returns complete characters and holds back the at
+    // most 3 bytes of a trailing partial one until the tokens completing it arrive. The returned view
+    // points into a buffer that is reused, without allocating once it has grown to the longest token,
+    // and stays valid until the next call.
+    class StreamingDecoder
+    {
+    public:
+        explicit StreamingDecoder(const BPETokenizer<std::string> &tokenizer) : tokenizer(tokenizer) { this->buffer.reserve(64); }
+
+        std::string_view push(unsigned short tokenId);
+        // Returns the held back bytes, which are not valid UTF-8 on their own, and resets the decoder
+        std::string_view finish();
+
+    private:
+        const BPETokenizer<std::string> &tokenizer;
+        std::string buffer;
+        size_t emitted = 0; // Bytes of buffer returned by the last call, the rest is held back
+
+        void discardEmitted();
+    };
+}
+
+#endif
@@ -0,0 +1,55 @@
+#ifndef SYNTHETIC_CORPUS_H
+#define SYNTHETIC_CORPUS_H
+
+#include <array>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace dokusha
+{
+    struct SyntheticCorpusOptions
+    {
+        uint64_t seed = 1;
+        size_t vocabularySize = 50000;  // Distinct words
+        double zipfExponent = 1.0;      // Word of frequency rank r is drawn with probability proportional to r^-zipfExponent
+        double meanWordLength = 5.0;    // Characters, not bytes; lengths are geometric with this mean
+        size_t maxWordLength = 24;
+        size_t meanWordsPerLine = 16;
+        // Relative weights of 1-byte (ASCII), 2-byte (Latin-1, Greek, Cyrillic), 3-byte (CJK) and 4-byte (emoji)
+        // UTF-8 characters. Every word is written in a single one of those scripts.
+        std::array<double, 4> scriptWeights{0.85, 0.08, 0.05, 0.02};
+    };
+
+    // Deterministic generator of text with Zipf-distributed word frequencies, for benchmarks that must be
+    // reproducible without shipping a real corpus. All randomness comes from a seeded SplitMix64 and
+    // hand-written distributions rather than the std:: ones, whose output differs between standard
+    // libraries, so the same options produce the same text from release to release.
+    class SyntheticCorpus
+    {
+    public:
+        explicit SyntheticCorpus(const SyntheticCorpusOptions &options);
+
+        // Appends one line, without its newline
+        void appendLine(std::string &output);
+        // Writes lines to the file until it holds at least bytes bytes
+        void writeFile(const std::string &path, uint64_t bytes);
+        // Splits bytes over numFiles files named 0.txt, 1.txt, ... in directory and returns their paths
+        std::vector<std::string> writeFiles(const std::string &directory, uint64_t bytes, size_t numFiles);
+
+        const std::vector<std::string> &words() const { return this->vocabulary; }
+
+    private:
+        SyntheticCorpusOptions options;
+        uint64_t state;
+        std::vector<std::string> vocabulary; // By frequency rank
+        std::vector<double> cumulative;      // Zipf CDF over the ranks
+
+        uint64_t next();
+        double uniform();
+        size_t geometric(double mean);
+        std::string makeWord();
+    };
+}
+
+#endif
@@ -0,0 +1,41 @@
+#ifndef TOKENIZER_HANDLE_H
+#define TOKENIZER_HANDLE_H
+
+#include <bpe.h>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+
+namespace dokusha
+{
+    // Shares a read-only tokenizer between threads and lets it be replaced while they use it.
+    //
+    // Readers take a snapshot with get() and encode with it for as long as they like; reload() builds
+    // the new tokenizer off to the side and publishes it with a single atomic store, so the encode path
+    // never waits for a reload. A replaced tokenizer is freed when the last snapshot of it is released,
+    // that is once the encodes in flight on it have finished.
+    class TokenizerHandle
+    {
+    public:
+        using Snapshot = std::shared_ptr<const BPETokenizer<std::string>>;
+
+        explicit TokenizerHandle(Snapshot tokenizer = nullptr) : current(std::move(tokenizer)) {}
+
+        Snapshot get() const { return this->current.load(std::memory_order_acquire); }
+        // Number of successful reloads
+        uint64_t version() const { return this->generation.load(std::memory_order_relaxed); }
+
+        // Maps the file, loads and validates it, and publishes the result. On failure the current tokenizer
+        // stays in place and false is returned, with the reason in error if given.
+        bool reload(const std::string &path, std::string *error = nullptr);
+
+    private:
+        std::atomic<Snapshot> current;
+        std::atomic<uint64_t> generation{0};
+        std::mutex reloadMutex; // Serializes reloads only, readers never take it
+    };
+}
+
+#endif
@@ -0,0 +1,57 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+namespace dokusha::trace
+{
+    // Timeline tracing in the Chrome trace event format, readable by chrome://tracing and Perfetto.
+    //
+    // Every thread records into a ring buffer of its own, so recording takes no lock and no atomic
+    // read-modify-write; once the buffer is full the oldest events are overwritten. A scope is kept
+    // as one complete event holding both its begin and its end, so a wrapped buffer never leaves a
+    // begin without its end. Tracing is off until start() is called, or until the library is loaded
+    // with DOKUSHA_TRACE_FILE set in the environment, and the trace is written at exit.
+    void start(const std::string &path, size_t eventsPerThread = 1 << 18);
+    bool enabled();
+    void record(const char *name, std::chrono::steady_clock::time_point begin, std::chrono::steady_clock::time_point end);
+    // Meant to be called once the traced threads are idle, as at exit
+    void writeChromeTrace(const std::string &path);
+
+    class Scope
+    {
+    public:
+        explicit Scope(const char *name) : name(enabled() ? name : nullptr)
+        {
+            if (this->name != nullptr)
+            {
+                this->begin = std::chrono::steady_clock::now();
+            }
+        }
+        ~Scope()
+        {
+            if (this->name != nullptr)
+            {
+                record(this->name, this->begin, std::chrono::steady_clock::now());
+            }
+        }
+
+    private:
+        const char *name;
+        std::chrono::steady_clock::time_point begin;
+    };
+}
+
+// Trace scopes compile to nothing unless DOKUSHA_TRACE is defined (the CMake option of the same name)
+#ifdef DOKUSHA_TRACE
+#define DOKUSHA_TRACE_CONCAT(name, line) name##line
+#define DOKUSHA_TRACE_NAME(line) DOKUSHA_TRACE_CONCAT(dokushaTraceScope, line)
+#define DOKUSHA_TRACE_SCOPE(name) ::dokusha::trace::Scope DOKUSHA_TRACE_NAME(__LINE__)(name)
+#else
+#define DOKUSHA_TRACE_SCOPE(name) ((void)0)
+#endif
+
+#endif
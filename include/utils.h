@@ -2,23 +2,21 @@
 #define UTILS_H
 
 #include <string>
+#include <string_view>
 
-static inline void trim(std::string &str) {
-    int beginIndex = 0;
-    int endIndex = str.size() - 1;
-    for (int i = beginIndex; i <= endIndex; i++) {
-        if (str[i] != ' ' && str[i] != '\n') {
-            beginIndex = i;
-            break;
-        }
-    }
-    for (int i = endIndex; i >= beginIndex; i--) {
-        if (str[i] != ' ' && str[i] != '\n') {
-            endIndex = i;
-            break;
-        }
+// View of what trim() leaves of str. Like trim(), this keeps an all-whitespace string as it is, and when
+// leading whitespace is dropped the length of the kept range is still counted from the start of str.
+static inline std::string_view trimmedView(std::string_view str) {
+    size_t beginIndex = str.find_first_not_of(" \n");
+    if (beginIndex == std::string_view::npos) {
+        return str;
     }
-    str = str.substr(beginIndex, endIndex + 1);
+    size_t endIndex = str.find_last_not_of(" \n");
+    return str.substr(beginIndex, endIndex + 1);
+}
+
+static inline void trim(std::string &str) {
+    str = std::string(trimmedView(str));
 }
 
 template <typename T> static inline void print(T object) {
@@ -1,4 +1,8 @@
 #include <bpe.h>
+#include <stats.h>
+#include <trace.h>
+#include <deque>
+#include <sstream>
 
 namespace dokusha
 {
@@ -33,21 +37,26 @@ namespace dokusha
     template <typename T>
     void BPETokenizer<T>::addToCorpus(std::string &line)
     {
+        DOKUSHA_TRACE_SCOPE("addToCorpus");
+        this->trainingPartitions.partitions.clear();
         trim(line);
         if (line.size() <= 1)
         {
             return;
         }
+        DOKUSHA_COUNT(IngestBytes, line.size());
+        DOKUSHA_COUNT(IngestLines, 1);
         line += " "; // In our case, we consider space as ending of the word!
         std::string currentWord;
-        std::vector<T> tokens;
+        TokenList tokens;
         std::string token = " ";
 
         for (const auto &ci : line)
         {
             if (ci == ' ')
             {
-                if (currentWord.size() > 15)
+                if (currentWord.size() > 15 ||
+                    (this->wordPartitionCount > 1 && std::hash<std::string>{}(currentWord) % this->wordPartitionCount != this->wordPartitionIndex))
                 {
                     currentWord = " ";
                     continue;
@@ -70,13 +79,14 @@ namespace dokusha
                     wordTokenListWithFrequency.first = std::move(tokens);
                 }
                 wordTokenListWithFrequency.second++;
+                DOKUSHA_COUNT(IngestWords, 1);
 
                 currentWord.clear();
             }
             currentWord += ci;
         }
 
-        for (const auto &rule : this->mergeRules)
+        for (const auto &rule : this->rankedMergeRules)
         {
             for (auto &element : wordWiseTokenListWithFrequency)
             {
@@ -86,9 +96,49 @@ namespace dokusha
     }
 
     template <typename T>
-    void BPETokenizer<T>::applyMergeRule(const std::pair<std::pair<T, T>, T> &rule, std::vector<T> &rawTokenList)
+    void BPETokenizer<T>::setWordPartition(unsigned index, unsigned count)
+    {
+        this->wordPartitionCount = std::max(1u, count);
+        this->wordPartitionIndex = index % this->wordPartitionCount;
+    }
+
+    template <typename T>
+    std::vector<std::pair<std::string, unsigned>> BPETokenizer<T>::releaseCorpus()
+    {
+        this->trainingPartitions.partitions.clear();
+        std::vector<std::pair<std::string, unsigned>> words;
+        words.reserve(this->wordWiseTokenListWithFrequency.size());
+        for (auto &element : this->wordWiseTokenListWithFrequency)
+        {
+            words.emplace_back(element.first, element.second.second);
+        }
+        this->wordWiseTokenListWithFrequency.clear();
+        return words;
+    }
+
+    template <typename T>
+    void BPETokenizer<T>::mergeCorpus(BPETokenizer<T> &other)
+    {
+        this->trainingPartitions.partitions.clear();
+        other.trainingPartitions.partitions.clear();
+        // Word frequencies are summed, the token lists of words new to this corpus are moved over
+        for (auto &element : other.wordWiseTokenListWithFrequency)
+        {
+            auto &wordTokenListWithFrequency = this->wordWiseTokenListWithFrequency[element.first];
+            if (wordTokenListWithFrequency.first.empty())
+            {
+                wordTokenListWithFrequency.first = std::move(element.second.first);
+            }
+            wordTokenListWithFrequency.second += element.second.second;
+        }
+        other.wordWiseTokenListWithFrequency.clear();
+    }
+
+    template <typename T>
+    template <typename TokenVector>
+    void BPETokenizer<T>::applyMergeRule(const std::pair<std::pair<T, T>, T> &rule, TokenVector &rawTokenList) const
     {
-        if (rawTokenList.size() == 1)
+        if (rawTokenList.size() <= 1)
         {
             return;
         }
@@ -97,7 +147,7 @@ namespace dokusha
         T token2 = rule.first.second;
         T mergedToken = rule.second;
 
-        for (std::vector<std::string>::iterator it = rawTokenList.begin();
+        for (auto it = rawTokenList.begin();
              it < rawTokenList.end() - 1;)
         {
             if (it->compare(token1) == 0 && (it + 1)->compare(token2) == 0)
@@ -119,6 +169,13 @@ namespace dokusha
     template <typename T>
     void BPETokenizer<T>::computePairFrequency()
     {
+        DOKUSHA_TIME(PairCount);
+        DOKUSHA_TRACE_SCOPE("computePairFrequency");
+        if (this->numaTraining)
+        {
+            this->computePartitionedPairFrequency();
+            return;
+        }
         this->pairFrequency.clear();
         for (const auto &element : this->wordWiseTokenListWithFrequency)
         {
@@ -130,15 +187,168 @@ namespace dokusha
         }
     }
 
+    template <typename T>
+    void BPETokenizer<T>::setNumaTraining(bool enabled)
+    {
+        this->numaTraining = enabled;
+        this->trainingPartitions.partitions.clear();
+    }
+
+    template <typename T>
+    void BPETokenizer<T>::partitionForTraining()
+    {
+        auto &partitions = this->trainingPartitions.partitions;
+        if (!partitions.empty())
+        {
+            return;
+        }
+
+        // Single-token words have no pairs and no merge changes them
+        std::vector<std::pair<TokenList, unsigned> *> entries;
+        entries.reserve(this->wordWiseTokenListWithFrequency.size());
+        for (auto &element : this->wordWiseTokenListWithFrequency)
+        {
+            if (element.second.first.size() > 1)
+            {
+                entries.push_back(&element.second);
+            }
+        }
+
+        const NumaTopology &topology = NumaTopology::system();
+        std::vector<ThreadPlacement> placements = topology.place(omp_get_max_threads());
+        stats::setSection("training_topology", topology.toJson(placements));
+        partitions.resize(placements.size());
+        for (size_t p = 0; p < partitions.size(); p++)
+        {
+            partitions[p].placement = placements[p];
+        }
+
+        const size_t numPartitions = partitions.size();
+        ScopedAffinity callerAffinity;
+#pragma omp parallel num_threads(numPartitions)
+        {
+            const size_t thread = omp_get_thread_num();
+            const size_t teamSize = omp_get_num_threads();
+            pinCurrentThread(partitions[thread].placement.cpu);
+            for (size_t p = thread; p < numPartitions; p += teamSize)
+            {
+                // The copies are first touched here, so the kernel backs them with pages of this thread's node
+                auto &words = partitions[p].words;
+                words.reserve(entries.size() / numPartitions + 1);
+                for (size_t i = p; i < entries.size(); i += numPartitions)
+                {
+                    TokenList local(entries[i]->first);
+                    entries[i]->first.swap(local);
+                    words.emplace_back(&entries[i]->first, entries[i]->second);
+                }
+            }
+        }
+    }
+
+    template <typename T>
+    void BPETokenizer<T>::computePartitionedPairFrequency()
+    {
+        this->partitionForTraining();
+        auto &partitions = this->trainingPartitions.partitions;
+        const size_t numPartitions = partitions.size();
+        auto fold = [](auto &into, auto &from)
+        {
+            for (const auto &element : from)
+            {
+                into[element.first] += element.second;
+            }
+        };
+
+        ScopedAffinity callerAffinity;
+#pragma omp parallel num_threads(numPartitions)
+        {
+            const size_t thread = omp_get_thread_num();
+            const size_t teamSize = omp_get_num_threads();
+            pinCurrentThread(partitions[thread].placement.cpu);
+            for (size_t p = thread; p < numPartitions; p += teamSize)
+            {
+                auto &pairCounts = partitions[p].pairCounts;
+                pairCounts.clear();
+                for (const auto &[tokens, frequency] : partitions[p].words)
+                {
+                    for (size_t i = 0; i + 1 < tokens->size(); i++)
+                    {
+                        pairCounts[std::make_pair((*tokens)[i], (*tokens)[i + 1])] += frequency;
+                    }
+                }
+            }
+
+#pragma omp barrier
+            // Every node leader folds in the counts of the other threads on its node, which stay within the node
+            for (size_t p = thread; p < numPartitions; p += teamSize)
+            {
+                if (!partitions[p].placement.nodeLeader)
+                {
+                    continue;
+                }
+                DOKUSHA_TIME(PairReduction);
+                for (size_t q = 0; q < numPartitions; q++)
+                {
+                    if (q != p && partitions[q].placement.node == partitions[p].placement.node)
+                    {
+                        fold(partitions[p].pairCounts, partitions[q].pairCounts);
+                    }
+                }
+            }
+        }
+
+        // Only one table per node crosses the interconnect
+        DOKUSHA_TIME(PairReduction);
+        this->pairFrequency.clear();
+        for (auto &partition : partitions)
+        {
+            if (!partition.placement.nodeLeader)
+            {
+                continue;
+            }
+            if (this->pairFrequency.empty())
+            {
+                this->pairFrequency.swap(partition.pairCounts);
+            }
+            else
+            {
+                fold(this->pairFrequency, partition.pairCounts);
+            }
+        }
+    }
+
     template <typename T>
     const unsigned short BPETokenizer<T>::getVocabularySize() const
     {
         return this->vocabulary.size();
     }
 
+    template <typename T>
+    MemoryUsage BPETokenizer<T>::memoryUsage() const
+    {
+        MemoryUsage usage;
+        usage.structures = {
+            memory::structure("wordWiseTokenListWithFrequency", this->wordWiseTokenListWithFrequency),
+            memory::structure("pairFrequency", this->pairFrequency),
+            memory::structure("mergeRules", this->mergeRules),
+            memory::structure("rankedMergeRules", this->rankedMergeRules),
+            memory::structure("vocabulary", this->vocabulary),
+            memory::structure("inverseVocabulary", this->inverseVocabulary),
+            memory::structure("baseVocabulary", this->baseVocabulary),
+            memory::structure("frequentWordEncodings", this->frequentWordEncodings),
+            StructureMemory{"mergeTable", this->rankedMergeRules.size(), this->mergeTable.memoryUsage()},
+            StructureMemory{"automaton", this->rankedMergeRules.size(), this->automaton.memoryUsage()},
+            StructureMemory{"decodeTable", this->inverseVocabulary.size(), this->decodeTable.memoryUsage()},
+            StructureMemory{"specialTokens", this->specialTokens.size(), this->specialTokens.memoryUsage()},
+            memory::structure("vocabularyLimits", this->vocabularyLimits)};
+        return usage;
+    }
+
     template <typename T>
     std::pair<T, T> BPETokenizer<T>::findBestPair()
     {
+        DOKUSHA_TIME(BestPair);
+        DOKUSHA_TRACE_SCOPE("findBestPair");
         int maxOccurance = 0;
         std::pair<T, T> bestPair;
 
@@ -157,7 +367,10 @@ namespace dokusha
     void inline BPETokenizer<T>::addToMergeRule(const std::pair<T, T> &bestPair,
                                                 const T &combinedToken)
     {
-        this->mergeRules[bestPair] = combinedToken;
+        if (this->mergeRules.insert_or_assign(bestPair, combinedToken).second)
+        {
+            this->rankedMergeRules.emplace_back(bestPair, combinedToken);
+        }
     }
 
     template <typename T>
@@ -221,31 +434,70 @@ namespace dokusha
     template <typename T>
     void BPETokenizer<T>::updateWordWiseTokenList(const T &token1, const T &token2)
     {
+        DOKUSHA_TIME(MergeApplication);
+        DOKUSHA_TRACE_SCOPE("updateWordWiseTokenList");
+        DOKUSHA_COUNT(Merges, 1);
+        if (this->numaTraining)
+        {
+            this->partitionForTraining();
+            auto &partitions = this->trainingPartitions.partitions;
+            const size_t numPartitions = partitions.size();
+            ScopedAffinity callerAffinity;
+#pragma omp parallel num_threads(numPartitions)
+            {
+                const size_t thread = omp_get_thread_num();
+                const size_t teamSize = omp_get_num_threads();
+                pinCurrentThread(partitions[thread].placement.cpu);
+                for (size_t p = thread; p < numPartitions; p += teamSize)
+                {
+                    for (auto &word : partitions[p].words)
+                    {
+                        if (mergeTokens(*word.first, token1, token2))
+                        {
+                            DOKUSHA_COUNT(WordsTouched, 1);
+                        }
+                    }
+                }
+            }
+            return;
+        }
+
         for (auto &element : this->wordWiseTokenListWithFrequency)
         {
             if (element.second.first.size() == 1)
             {
                 continue;
             }
+            // Not inside DOKUSHA_COUNT, which drops its arguments when statistics are compiled out
+            if (mergeTokens(element.second.first, token1, token2))
+            {
+                DOKUSHA_COUNT(WordsTouched, 1);
+            }
+        }
+    }
 
-            for (std::vector<std::string>::iterator it = element.second.first.begin();
-                 it < element.second.first.end() - 1;)
+    template <typename T>
+    bool BPETokenizer<T>::mergeTokens(TokenList &tokens, const T &token1, const T &token2)
+    {
+        bool merged = false;
+        for (typename TokenList::iterator it = tokens.begin(); it < tokens.end() - 1;)
+        {
+            if (it->compare(token1) == 0 && (it + 1)->compare(token2) == 0)
             {
-                if (it->compare(token1) == 0 && (it + 1)->compare(token2) == 0)
-                {
-                    *it = token1 + token2;
-                    it++;
-                    if (it != element.second.first.end())
-                    {
-                        it = element.second.first.erase(it);
-                    }
-                }
-                else
+                *it = token1 + token2;
+                merged = true;
+                it++;
+                if (it != tokens.end())
                 {
-                    it++;
+                    it = tokens.erase(it);
                 }
             }
+            else
+            {
+                it++;
+            }
         }
+        return merged;
     }
 
     template <typename T>
@@ -254,15 +506,23 @@ namespace dokusha
         std::pair<std::string, std::string> bestPair;
         this->computePairFrequency();
         bestPair = this->findBestPair();
-        std::string combined_token = bestPair.first + bestPair.second;
-        this->addToMergeRule(bestPair, combined_token);
-        this->addToVocabulary(combined_token);
+        this->addMerge(bestPair);
         this->updateWordWiseTokenList(bestPair.first, bestPair.second);
     }
 
+    template <typename T>
+    unsigned short BPETokenizer<T>::addMerge(const std::pair<T, T> &pair)
+    {
+        std::string combinedToken = pair.first + pair.second;
+        this->addToMergeRule(pair, combinedToken);
+        this->addToVocabulary(combinedToken);
+        return this->vocabulary[combinedToken];
+    }
+
     template <typename T>
     void BPETokenizer<T>::pruneWordList()
     {
+        this->trainingPartitions.partitions.clear();
         size_t startNumWords = this->wordWiseTokenListWithFrequency.size();
         for (auto it = this->wordWiseTokenListWithFrequency.begin(); it != this->wordWiseTokenListWithFrequency.end();)
         {
@@ -280,9 +540,8 @@ namespace dokusha
     }
 
     template <typename T>
-    std::vector<unsigned short> BPETokenizer<T>::tokenize(std::string text)
+    std::vector<std::vector<T>> BPETokenizer<T>::preTokenize(std::string text) const
     {
-        std::vector<unsigned short> tokenizedText;
         trim(text);
 
         text += " "; // In our case, we consider space as ending of the word!
@@ -305,49 +564,522 @@ namespace dokusha
             }
             currentWord += ci;
         }
+        return tokenList;
+    }
+
+    template <typename T>
+    void BPETokenizer<T>::encodeWord(std::string_view word, std::vector<unsigned short> &output) const
+    {
+        if (!this->frequentWordEncodings.empty())
+        {
+            auto frequentWordIter = this->frequentWordEncodings.find(std::string(word));
+            if (frequentWordIter != this->frequentWordEncodings.end())
+            {
+                output.insert(output.end(), frequentWordIter->second.begin(), frequentWordIter->second.end());
+                return;
+            }
+        }
+
+        if (this->automaton.isCompiledFor(this->rankedMergeRules.size()))
+        {
+            this->automaton.encodeWord(word, this->mergeTable, output);
+            return;
+        }
+
+        if (this->mergeTable.isCompiledFor(this->rankedMergeRules.size()))
+        {
+            this->mergeTable.encodeWord(word, output);
+            return;
+        }
+
+        std::vector<T> tokens;
+        for (const auto &ci : word)
+        {
+            tokens.push_back(T(1, ci));
+        }
+
+        // Rules are replayed in the order they were learned, which reproduces the splits seen in training
+        for (const auto &rule : this->rankedMergeRules)
+        {
+            if (tokens.size() <= 1)
+            {
+                break;
+            }
+            this->applyMergeRule(rule, tokens);
+        }
+
+        for (const auto &token : tokens)
+        {
+            auto vocabularyIter = this->vocabulary.find(token);
+            if (vocabularyIter == this->vocabulary.end())
+            {
+                output.push_back(0);
+            }
+            else
+            {
+                output.push_back(vocabularyIter->second);
+            }
+        }
+    }
+
+    template <typename T>
+    std::vector<unsigned short> BPETokenizer<T>::encodeWords(std::vector<std::vector<T>> &tokenList) const
+    {
+        std::vector<unsigned short> tokenizedText;
+        std::string word;
+
+        for (const auto &element : tokenList)
+        {
+            word.clear();
+            for (const auto &token : element)
+            {
+                word += token;
+            }
+            this->encodeWord(word, tokenizedText);
+        }
+
+        return tokenizedText;
+    }
+
+    template <typename T>
+    std::vector<unsigned short> BPETokenizer<T>::tokenize(std::string text) const
+    {
+        DOKUSHA_COUNT(EncodeCalls, 1);
+        DOKUSHA_COUNT(EncodeBytes, text.size());
+        std::vector<unsigned short> tokenizedText;
+        if (!this->specialTokens.empty())
+        {
+            this->encodeSpan(trimmedView(text), tokenizedText);
+        }
+        else
+        {
+            std::vector<std::vector<T>> tokenList = this->preTokenize(std::move(text));
+            tokenizedText = this->encodeWords(tokenList);
+        }
+        DOKUSHA_COUNT(EncodeTokens, tokenizedText.size());
+        return tokenizedText;
+    }
+
+    template <typename T>
+    void BPETokenizer<T>::encodeSpan(std::string_view text, std::vector<unsigned short> &output) const
+    {
+        this->forEachPiece(text, [&](std::string_view piece, int specialTokenId)
+        {
+            if (specialTokenId >= 0)
+            {
+                output.push_back(specialTokenId);
+            }
+            else
+            {
+                this->encodeWord(piece, output);
+            }
+            return true;
+        });
+    }
+
+    template <typename T>
+    void BPETokenizer<T>::encodeWordWithMergeLimit(std::string_view word, size_t mergeLimit, std::vector<unsigned short> &output) const
+    {
+        if (this->mergeTable.isCompiledFor(this->rankedMergeRules.size()))
+        {
+            this->mergeTable.encodeWord(word, output, static_cast<uint32_t>(std::min<size_t>(mergeLimit, MergeTable::noRank)));
+            return;
+        }
+
+        std::vector<T> tokens;
+        for (const auto &ci : word)
+        {
+            tokens.push_back(T(1, ci));
+        }
+        for (size_t rank = 0; rank < std::min(mergeLimit, this->rankedMergeRules.size()) && tokens.size() > 1; rank++)
+        {
+            this->applyMergeRule(this->rankedMergeRules[rank], tokens);
+        }
+        for (const auto &token : tokens)
+        {
+            auto vocabularyIter = this->vocabulary.find(token);
+            output.push_back(vocabularyIter == this->vocabulary.end() ? 0 : vocabularyIter->second);
+        }
+    }
 
-        for (const auto &rule : this->mergeRules)
+    template <typename T>
+    void BPETokenizer<T>::encodeSpan(std::string_view text, std::vector<unsigned short> &output, size_t mergeLimit) const
+    {
+        if (mergeLimit >= this->rankedMergeRules.size())
+        {
+            this->encodeSpan(text, output);
+            return;
+        }
+        this->forEachPiece(text, [&](std::string_view piece, int specialTokenId)
         {
-            for (auto &element : tokenList)
+            if (specialTokenId >= 0)
             {
-                this->applyMergeRule(rule, element);
+                output.push_back(specialTokenId);
             }
+            else
+            {
+                this->encodeWordWithMergeLimit(piece, mergeLimit, output);
+            }
+            return true;
+        });
+    }
+
+    template <typename T>
+    std::vector<unsigned short> BPETokenizer<T>::tokenizeWithMergeLimit(const std::string &text, size_t mergeLimit) const
+    {
+        DOKUSHA_COUNT(EncodeCalls, 1);
+        DOKUSHA_COUNT(EncodeBytes, text.size());
+        std::vector<unsigned short> tokenizedText;
+        this->encodeSpan(trimmedView(text), tokenizedText, mergeLimit);
+        DOKUSHA_COUNT(EncodeTokens, tokenizedText.size());
+        return tokenizedText;
+    }
+
+    template <typename T>
+    size_t BPETokenizer<T>::vocabularyLimit(size_t mergeLimit) const
+    {
+        mergeLimit = std::min(mergeLimit, this->rankedMergeRules.size());
+        if (this->vocabularyLimits.size() == this->rankedMergeRules.size() + 1)
+        {
+            return this->vocabularyLimits[mergeLimit];
         }
 
-        for (const auto &word : tokenList)
+        size_t limit = 0;
+        for (unsigned byte = 0; byte < 256; byte++)
+        {
+            auto vocabularyIter = this->vocabulary.find(T(1, static_cast<char>(byte)));
+            limit = std::max<size_t>(limit, vocabularyIter == this->vocabulary.end() ? 0 : vocabularyIter->second + 1);
+        }
+        for (size_t rank = 0; rank < mergeLimit; rank++)
         {
-            for (const auto &token : word)
+            auto vocabularyIter = this->vocabulary.find(this->rankedMergeRules[rank].second);
+            limit = std::max<size_t>(limit, vocabularyIter == this->vocabulary.end() ? 0 : vocabularyIter->second + 1);
+        }
+        return limit;
+    }
+
+    template <typename T>
+    std::vector<unsigned short> BPETokenizer<T>::tokenize(const std::string &text, size_t maxTokens) const
+    {
+        std::vector<unsigned short> tokenizedText;
+        this->forEachPiece(trimmedView(text), [&](std::string_view piece, int specialTokenId)
+        {
+            if (specialTokenId >= 0)
+            {
+                tokenizedText.push_back(specialTokenId);
+            }
+            else
             {
-                if (vocabulary.find(token) == vocabulary.end())
+                this->encodeWord(piece, tokenizedText);
+            }
+            return tokenizedText.size() < maxTokens;
+        });
+
+        if (tokenizedText.size() > maxTokens)
+        {
+            tokenizedText.resize(maxTokens);
+        }
+        DOKUSHA_COUNT(EncodeCalls, 1);
+        DOKUSHA_COUNT(EncodeBytes, text.size());
+        DOKUSHA_COUNT(EncodeTokens, tokenizedText.size());
+        return tokenizedText;
+    }
+
+    template <typename T>
+    TokenizedText BPETokenizer<T>::tokenizeWithOffsets(const std::string &text) const
+    {
+        TokenizedText tokenizedText;
+        this->forEachPiece(trimmedView(text), [&](std::string_view piece, int specialTokenId)
+        {
+            size_t firstToken = tokenizedText.ids.size();
+            if (specialTokenId >= 0)
+            {
+                tokenizedText.ids.push_back(specialTokenId);
+            }
+            else
+            {
+                this->encodeWord(piece, tokenizedText.ids);
+            }
+
+            // Pieces are views into text, and the tokens of a piece spell it out byte for byte
+            uint32_t offset = piece.data() - text.data();
+            const uint32_t wordEnd = offset + piece.size();
+            for (size_t i = firstToken; i < tokenizedText.ids.size(); i++)
+            {
+                tokenizedText.offsets.push_back(std::min(offset, wordEnd));
+                offset += this->tokenBytes(tokenizedText.ids[i]).size();
+            }
+            return true;
+        });
+        DOKUSHA_COUNT(EncodeCalls, 1);
+        DOKUSHA_COUNT(EncodeBytes, text.size());
+        DOKUSHA_COUNT(EncodeTokens, tokenizedText.ids.size());
+        return tokenizedText;
+    }
+
+    template <typename T>
+    size_t BPETokenizer<T>::countTokens(const std::string &text) const
+    {
+        // Every word is encoded into the same small buffer, the tokens of the text are never collected
+        size_t numTokens = 0;
+        std::vector<unsigned short> wordTokens;
+        this->forEachPiece(trimmedView(text), [&](std::string_view piece, int specialTokenId)
+        {
+            if (specialTokenId >= 0)
+            {
+                numTokens++;
+                return true;
+            }
+            wordTokens.clear();
+            this->encodeWord(piece, wordTokens);
+            numTokens += wordTokens.size();
+            return true;
+        });
+        DOKUSHA_COUNT(EncodeCalls, 1);
+        DOKUSHA_COUNT(EncodeBytes, text.size());
+        DOKUSHA_COUNT(EncodeTokens, numTokens);
+        return numTokens;
+    }
+
+    template <typename T>
+    std::vector<std::vector<unsigned short>> BPETokenizer<T>::tokenizeBatch(const std::vector<std::string> &texts) const
+    {
+        DOKUSHA_TRACE_SCOPE("tokenizeBatch");
+        std::vector<std::vector<unsigned short>> tokenizedTexts;
+        tokenizedTexts.reserve(texts.size());
+
+        if (!this->mergeTable.isCompiledFor(this->rankedMergeRules.size()))
+        {
+            for (const auto &text : texts)
+            {
+                tokenizedTexts.push_back(this->tokenize(text));
+            }
+            return tokenizedTexts;
+        }
+
+        // Every word is a special token, hits the frequent word table, is long enough to go straight to the automaton, or is
+        // queued for the interleaved encoder, whose cost grows quadratically with the word length
+        struct WordSource
+        {
+            const std::vector<unsigned short> *encoding;
+            size_t queuedIndex;
+        };
+        static constexpr size_t longWordLength = 64;
+        const bool useAutomaton = this->automaton.isCompiledFor(this->rankedMergeRules.size());
+        std::deque<std::vector<unsigned short>> directEncodings; // Long words and special tokens
+
+        std::vector<std::vector<WordSource>> textWords(texts.size());
+        std::vector<std::string_view> queuedWords;
+        std::string word;
+
+        for (size_t i = 0; i < texts.size(); i++)
+        {
+            DOKUSHA_COUNT(EncodeCalls, 1);
+            DOKUSHA_COUNT(EncodeBytes, texts[i].size());
+            this->forEachPiece(trimmedView(texts[i]), [&](std::string_view currentWord, int specialTokenId)
+            {
+                if (specialTokenId >= 0)
                 {
-                    tokenizedText.push_back(0);
+                    directEncodings.emplace_back(1, specialTokenId);
+                    textWords[i].push_back(WordSource{&directEncodings.back(), 0});
+                    return true;
+                }
+                if (!this->frequentWordEncodings.empty())
+                {
+                    word.assign(currentWord);
+                    auto frequentWordIter = this->frequentWordEncodings.find(word);
+                    if (frequentWordIter != this->frequentWordEncodings.end())
+                    {
+                        textWords[i].push_back(WordSource{&frequentWordIter->second, 0});
+                        return true;
+                    }
+                }
+                if (useAutomaton && currentWord.size() > longWordLength)
+                {
+                    directEncodings.emplace_back();
+                    this->automaton.encodeWord(currentWord, this->mergeTable, directEncodings.back());
+                    textWords[i].push_back(WordSource{&directEncodings.back(), 0});
+                    return true;
+                }
+                textWords[i].push_back(WordSource{nullptr, queuedWords.size()});
+                queuedWords.push_back(currentWord);
+                return true;
+            });
+        }
+
+        std::vector<unsigned short> queuedTokens;
+        std::vector<std::pair<size_t, size_t>> queuedSpans;
+        {
+            DOKUSHA_TRACE_SCOPE("encodeWords");
+            this->mergeTable.encodeWords(queuedWords, queuedTokens, queuedSpans);
+        }
+
+        for (const auto &words : textWords)
+        {
+            std::vector<unsigned short> tokenizedText;
+            for (const auto &source : words)
+            {
+                if (source.encoding != nullptr)
+                {
+                    tokenizedText.insert(tokenizedText.end(), source.encoding->begin(), source.encoding->end());
                 }
                 else
                 {
-                    tokenizedText.push_back(vocabulary[token]);
+                    auto span = queuedSpans[source.queuedIndex];
+                    tokenizedText.insert(tokenizedText.end(), queuedTokens.begin() + span.first, queuedTokens.begin() + span.first + span.second);
                 }
             }
+            DOKUSHA_COUNT(EncodeTokens, tokenizedText.size());
+            tokenizedTexts.push_back(std::move(tokenizedText));
         }
 
-        // this->printTokenizedText(tokenizedText);
+        return tokenizedTexts;
+    }
 
-        return tokenizedText;
+    template <typename T>
+    void BPETokenizer<T>::compileMergeTable()
+    {
+        if (this->mergeTable.build(this->rankedMergeRules, this->vocabulary))
+        {
+            this->automaton.compile(this->mergeTable);
+        }
+        this->decodeTable.build(this->inverseVocabulary, this->specialTokens.tokens());
+
+        // IDs are handed out in the order tokens are learned, so every rule can only raise the limit
+        this->vocabularyLimits.clear();
+        this->vocabularyLimits.push_back(this->vocabularyLimit(0));
+        for (const auto &rule : this->rankedMergeRules)
+        {
+            auto vocabularyIter = this->vocabulary.find(rule.second);
+            uint32_t id = vocabularyIter == this->vocabulary.end() ? 0 : vocabularyIter->second + 1;
+            this->vocabularyLimits.push_back(std::max(this->vocabularyLimits.back(), id));
+        }
+    }
+
+    template <typename T>
+    bool BPETokenizer<T>::addSpecialToken(const std::string &token, unsigned short tokenId)
+    {
+        const bool decodeTableWasCurrent = this->decodeTableIsCurrent();
+        if (this->inverseVocabulary.contains(tokenId) || !this->specialTokens.add(token, tokenId))
+        {
+            return false;
+        }
+        if (decodeTableWasCurrent)
+        {
+            this->decodeTable.build(this->inverseVocabulary, this->specialTokens.tokens());
+        }
+        return true;
+    }
+
+    template <typename T>
+    std::optional<unsigned short> BPETokenizer<T>::tokenId(const T &token) const
+    {
+        auto vocabularyIter = this->vocabulary.find(token);
+        if (vocabularyIter == this->vocabulary.end())
+        {
+            return std::nullopt;
+        }
+        return vocabularyIter->second;
+    }
+
+    template <typename T>
+    std::string_view BPETokenizer<T>::tokenBytes(unsigned short tokenId) const
+    {
+        if (this->decodeTableIsCurrent())
+        {
+            return this->decodeTable.token(tokenId);
+        }
+        auto inverseVocabularyIter = this->inverseVocabulary.find(tokenId);
+        if (inverseVocabularyIter != this->inverseVocabulary.end())
+        {
+            return inverseVocabularyIter->second;
+        }
+        auto specialTokenIter = this->specialTokens.tokens().find(tokenId);
+        return specialTokenIter == this->specialTokens.tokens().end() ? std::string_view() : std::string_view(specialTokenIter->second);
     }
 
     template <typename T>
     std::string BPETokenizer<T>::detokenize(std::vector<unsigned short> tokenizedText)
     {
         std::string result = "";
-        for (auto &token : tokenizedText)
+        if (this->decodeTableIsCurrent())
         {
-            result += this->inverseVocabulary[token];
+            this->decodeTable.decode(tokenizedText.data(), tokenizedText.size(), result);
+        }
+        else
+        {
+            for (auto &token : tokenizedText)
+            {
+                result += this->tokenBytes(token);
+            }
         }
 
+        DOKUSHA_COUNT(DecodeCalls, 1);
+        DOKUSHA_COUNT(DecodeTokens, tokenizedText.size());
+        DOKUSHA_COUNT(DecodeBytes, result.size());
         return result;
     }
 
     template <typename T>
-    void BPETokenizer<T>::save(const std::string filepath) const
+    std::optional<std::string> BPETokenizer<T>::detokenizeWithMergeLimit(const std::vector<unsigned short> &tokenizedText, size_t mergeLimit) const
+    {
+        for (const auto &token : tokenizedText)
+        {
+            if (!this->isValidTokenId(token, mergeLimit))
+            {
+                return std::nullopt;
+            }
+        }
+
+        std::string result;
+        if (this->decodeTableIsCurrent())
+        {
+            this->decodeTable.decode(tokenizedText.data(), tokenizedText.size(), result);
+        }
+        else
+        {
+            for (const auto &token : tokenizedText)
+            {
+                result += this->tokenBytes(token);
+            }
+        }
+
+        DOKUSHA_COUNT(DecodeCalls, 1);
+        DOKUSHA_COUNT(DecodeTokens, tokenizedText.size());
+        DOKUSHA_COUNT(DecodeBytes, result.size());
+        return result;
+    }
+
+    template <typename T>
+    std::vector<std::string> BPETokenizer<T>::detokenizeBatch(const std::vector<std::vector<unsigned short>> &tokenizedTexts) const
+    {
+        std::vector<std::string> results(tokenizedTexts.size());
+        const bool useDecodeTable = this->decodeTableIsCurrent();
+
+#pragma omp parallel for schedule(dynamic, 16)
+        for (size_t i = 0; i < tokenizedTexts.size(); i++)
+        {
+            if (useDecodeTable)
+            {
+                this->decodeTable.decode(tokenizedTexts[i].data(), tokenizedTexts[i].size(), results[i]);
+            }
+            else
+            {
+                for (const auto &token : tokenizedTexts[i])
+                {
+                    results[i] += this->tokenBytes(token);
+                }
+            }
+            DOKUSHA_COUNT(DecodeCalls, 1);
+            DOKUSHA_COUNT(DecodeTokens, tokenizedTexts[i].size());
+            DOKUSHA_COUNT(DecodeBytes, results[i].size());
+        }
+
+        return results;
+    }
+
+    template <typename T>
+    void BPETokenizer<T>::save(const std::string filepath, size_t frequentWordCount) const
     {
         std::ofstream outFile(filepath, std::ios::binary);
         outFile.write(reinterpret_cast<const char *>(&this->vocabularySize), sizeof(this->vocabularySize));
@@ -368,7 +1100,7 @@ namespace dokusha
         unsigned short token2Length;
         unsigned short combinedTokenLength;
 
-        for (auto &rule : this->mergeRules)
+        for (auto &rule : this->rankedMergeRules)
         {
             token1Length = static_cast<unsigned short>(rule.first.first.size());
             token2Length = static_cast<unsigned short>(rule.first.second.size());
@@ -381,20 +1113,88 @@ namespace dokusha
             outFile.write(rule.second.c_str(), combinedTokenLength);
         }
 
+        // Optional sections follow the merge rules as (uint8 tag, uint32 size, payload), so readers can skip unknown ones
+        if (frequentWordCount > 0)
+        {
+            std::vector<const std::pair<const std::string, std::pair<TokenList, unsigned>> *> frequentWords;
+            frequentWords.reserve(this->wordWiseTokenListWithFrequency.size());
+            for (const auto &element : this->wordWiseTokenListWithFrequency)
+            {
+                frequentWords.push_back(&element);
+            }
+            frequentWordCount = std::min(frequentWordCount, frequentWords.size());
+            std::partial_sort(frequentWords.begin(), frequentWords.begin() + frequentWordCount, frequentWords.end(),
+                              [](const auto *lhs, const auto *rhs)
+                              { return lhs->second.second != rhs->second.second ? lhs->second.second > rhs->second.second : lhs->first < rhs->first; });
+
+            std::ostringstream section;
+            uint32_t entryCount = frequentWordCount;
+            section.write(reinterpret_cast<const char *>(&entryCount), sizeof(entryCount));
+            for (size_t i = 0; i < frequentWordCount; i++)
+            {
+                const auto &word = frequentWords[i]->first;
+                const auto &tokens = frequentWords[i]->second.first;
+                stringLength = word.size();
+                section.write(reinterpret_cast<const char *>(&stringLength), sizeof(stringLength));
+                section.write(word.c_str(), stringLength);
+
+                unsigned short tokenCount = tokens.size();
+                section.write(reinterpret_cast<const char *>(&tokenCount), sizeof(tokenCount));
+                for (const auto &token : tokens)
+                {
+                    auto vocabularyIter = this->vocabulary.find(token);
+                    unsigned short tokenID = vocabularyIter == this->vocabulary.end() ? 0 : vocabularyIter->second;
+                    section.write(reinterpret_cast<const char *>(&tokenID), sizeof(tokenID));
+                }
+            }
+
+            std::string payload = section.str();
+            uint32_t sectionSize = payload.size();
+            outFile.write(reinterpret_cast<const char *>(&frequentWordSection), sizeof(frequentWordSection));
+            outFile.write(reinterpret_cast<const char *>(&sectionSize), sizeof(sectionSize));
+            outFile.write(payload.data(), sectionSize);
+        }
+
+        if (!this->specialTokens.empty())
+        {
+            std::ostringstream section;
+            uint32_t entryCount = this->specialTokens.size();
+            section.write(reinterpret_cast<const char *>(&entryCount), sizeof(entryCount));
+            for (const auto &[tokenID, token] : this->specialTokens.tokens())
+            {
+                stringLength = token.size();
+                section.write(reinterpret_cast<const char *>(&tokenID), sizeof(tokenID));
+                section.write(reinterpret_cast<const char *>(&stringLength), sizeof(stringLength));
+                section.write(token.c_str(), stringLength);
+            }
+
+            std::string payload = section.str();
+            uint32_t sectionSize = payload.size();
+            outFile.write(reinterpret_cast<const char *>(&specialTokenSection), sizeof(specialTokenSection));
+            outFile.write(reinterpret_cast<const char *>(&sectionSize), sizeof(sectionSize));
+            outFile.write(payload.data(), sectionSize);
+        }
+
         outFile.close();
     }
 
     template <typename T>
-    void BPETokenizer<T>::load(const std::string filepath)
+    bool BPETokenizer<T>::load(const std::string filepath)
     {
         std::ifstream inFile(filepath, std::ios::binary);
+        return inFile && this->load(inFile);
+    }
+
+    template <typename T>
+    bool BPETokenizer<T>::load(std::istream &inFile)
+    {
         inFile.read(reinterpret_cast<char *>(&this->vocabularySize), sizeof(this->vocabularySize));
 
         unsigned short stringLength;
         unsigned short tokenID;
         std::string tempToken;
 
-        for (int i = 0; i < this->vocabularySize - 1; i++)
+        for (int i = 0; i < this->vocabularySize - 1 && inFile; i++)
         {
             inFile.read(reinterpret_cast<char *>(&stringLength), sizeof(stringLength));
             tempToken.resize(stringLength);
@@ -414,7 +1214,7 @@ namespace dokusha
         unsigned short token2Length;
         std::string combinedToken;
         unsigned short combinedTokenLength;
-        for (int i = 0; i < mergeRuleSize; i++)
+        for (int i = 0; i < mergeRuleSize && inFile; i++)
         {
             inFile.read(reinterpret_cast<char *>(&token1Length), sizeof(token1Length));
             token1.resize(token1Length);
@@ -429,8 +1229,57 @@ namespace dokusha
             inFile.read(&combinedToken[0], combinedTokenLength);
             this->addToMergeRule(std::make_pair(token1, token2), combinedToken);
         }
+        if (!inFile)
+        {
+            return false;
+        }
 
-        inFile.close();
+        this->frequentWordEncodings.clear();
+        this->specialTokens = SpecialTokens();
+        unsigned char sectionTag;
+        uint32_t sectionSize;
+        while (inFile.read(reinterpret_cast<char *>(&sectionTag), sizeof(sectionTag)) &&
+               inFile.read(reinterpret_cast<char *>(&sectionSize), sizeof(sectionSize)))
+        {
+            if (sectionTag == specialTokenSection)
+            {
+                uint32_t entryCount;
+                inFile.read(reinterpret_cast<char *>(&entryCount), sizeof(entryCount));
+                for (uint32_t i = 0; i < entryCount && inFile; i++)
+                {
+                    inFile.read(reinterpret_cast<char *>(&tokenID), sizeof(tokenID));
+                    inFile.read(reinterpret_cast<char *>(&stringLength), sizeof(stringLength));
+                    tempToken.resize(stringLength);
+                    inFile.read(&tempToken[0], stringLength);
+                    this->specialTokens.add(tempToken, tokenID);
+                }
+                continue;
+            }
+            if (sectionTag != frequentWordSection)
+            {
+                inFile.seekg(sectionSize, std::ios::cur);
+                continue;
+            }
+
+            uint32_t entryCount;
+            inFile.read(reinterpret_cast<char *>(&entryCount), sizeof(entryCount));
+            this->frequentWordEncodings.reserve(entryCount);
+            for (uint32_t i = 0; i < entryCount && inFile; i++)
+            {
+                inFile.read(reinterpret_cast<char *>(&stringLength), sizeof(stringLength));
+                tempToken.resize(stringLength);
+                inFile.read(&tempToken[0], stringLength);
+
+                unsigned short tokenCount;
+                inFile.read(reinterpret_cast<char *>(&tokenCount), sizeof(tokenCount));
+                std::vector<unsigned short> tokens(tokenCount);
+                inFile.read(reinterpret_cast<char *>(tokens.data()), tokenCount * sizeof(unsigned short));
+                this->frequentWordEncodings.emplace(tempToken, std::move(tokens));
+            }
+        }
+
+        this->compileMergeTable();
+        return true;
     }
 
     // Visualization functions
@@ -0,0 +1,246 @@
+#include <bpe_automaton.h>
+#include <memory_usage.h>
+#include <algorithm>
+#include <bit>
+#include <deque>
+
+namespace dokusha
+{
+    uint32_t BPEAutomaton::child(uint32_t state, unsigned char byte) const
+    {
+        uint64_t key = (static_cast<uint64_t>(state) << 8) | byte;
+        for (size_t index = this->edgeIndex(key);; index = (index + 1) & this->edgeMask)
+        {
+            if (this->edges[index].key == key)
+            {
+                return this->edges[index].target;
+            }
+            if (this->edges[index].key == emptyKey)
+            {
+                return noToken;
+            }
+        }
+    }
+
+    uint32_t BPEAutomaton::addChild(uint32_t state, unsigned char byte)
+    {
+        uint64_t key = (static_cast<uint64_t>(state) << 8) | byte;
+        size_t index = this->edgeIndex(key);
+        while (this->edges[index].key != emptyKey && this->edges[index].key != key)
+        {
+            index = (index + 1) & this->edgeMask;
+        }
+        if (this->edges[index].key == emptyKey)
+        {
+            this->edges[index] = Edge{key, static_cast<uint32_t>(this->failure.size())};
+            this->failure.push_back(0);
+        }
+        return this->edges[index].target;
+    }
+
+    uint32_t BPEAutomaton::transition(uint32_t state, unsigned char byte) const
+    {
+        while (true)
+        {
+            uint32_t next = this->child(state, byte);
+            if (next != noToken)
+            {
+                return next;
+            }
+            if (state == 0)
+            {
+                return 0;
+            }
+            state = this->failure[state];
+        }
+    }
+
+    size_t BPEAutomaton::memoryUsage() const
+    {
+        return memory::heapBytes(this->edges) + memory::heapBytes(this->failure) + memory::heapBytes(this->longestMatch) +
+               memory::heapBytes(this->tokenLength) + memory::heapBytes(this->nextShorter) + memory::heapBytes(this->splits) +
+               memory::heapBytes(this->outputIds);
+    }
+
+    bool BPEAutomaton::compile(const MergeTable &mergeTable)
+    {
+        this->compiled = false;
+        this->numRules = mergeTable.ruleCount();
+        const size_t numTokens = mergeTable.tokenCount();
+
+        // Canonical rules give every merged token the internal ID 256 + rank, which the pair check relies on
+        if (numTokens != 256 + this->numRules)
+        {
+            return false;
+        }
+        std::vector<uint32_t> encoding;
+        for (uint32_t token = 0; token < numTokens; token++)
+        {
+            encoding.clear();
+            mergeTable.encodeWordInternal(mergeTable.tokenString(token), encoding);
+            if (encoding.size() != 1 || encoding[0] != token)
+            {
+                return false;
+            }
+        }
+
+        size_t totalLength = 0;
+        for (uint32_t token = 0; token < numTokens; token++)
+        {
+            totalLength += mergeTable.tokenString(token).size();
+        }
+        size_t capacity = std::bit_ceil(2 * (totalLength + 1));
+        this->edges.assign(capacity, Edge{emptyKey, 0});
+        this->edgeMask = capacity - 1;
+        this->failure.assign(1, 0);
+
+        // Trie over all token strings, remembering which state spells which token
+        std::vector<uint32_t> tokenState(numTokens);
+        std::vector<std::vector<std::pair<unsigned char, uint32_t>>> children(totalLength + 1);
+        for (uint32_t token = 0; token < numTokens; token++)
+        {
+            uint32_t state = 0;
+            for (const auto &ci : mergeTable.tokenString(token))
+            {
+                size_t numStates = this->failure.size();
+                uint32_t next = this->addChild(state, static_cast<unsigned char>(ci));
+                if (this->failure.size() > numStates)
+                {
+                    children[state].emplace_back(static_cast<unsigned char>(ci), next);
+                }
+                state = next;
+            }
+            tokenState[token] = state;
+        }
+
+        const size_t numStates = this->failure.size();
+        std::vector<uint32_t> stateToken(numStates, noToken);
+        for (uint32_t token = 0; token < numTokens; token++)
+        {
+            stateToken[tokenState[token]] = token;
+        }
+
+        // Failure links in breadth-first order, so every link points to an already finished state
+        this->longestMatch.assign(numStates, noToken);
+        std::deque<uint32_t> queue{0};
+        while (!queue.empty())
+        {
+            uint32_t state = queue.front();
+            queue.pop_front();
+            for (const auto &[byte, next] : children[state])
+            {
+                uint32_t fallback = 0;
+                if (state != 0)
+                {
+                    fallback = this->failure[state];
+                    while (fallback != 0 && this->child(fallback, byte) == noToken)
+                    {
+                        fallback = this->failure[fallback];
+                    }
+                    uint32_t target = this->child(fallback, byte);
+                    fallback = target == noToken ? 0 : target;
+                }
+                this->failure[next] = fallback;
+                this->longestMatch[next] = stateToken[next] != noToken ? stateToken[next] : this->longestMatch[fallback];
+                queue.push_back(next);
+            }
+        }
+
+        this->tokenLength.resize(numTokens);
+        this->nextShorter.resize(numTokens);
+        this->splits.resize(numTokens);
+        this->outputIds.resize(numTokens);
+        for (uint32_t token = 0; token < numTokens; token++)
+        {
+            this->tokenLength[token] = mergeTable.tokenString(token).size();
+            this->nextShorter[token] = this->longestMatch[this->failure[tokenState[token]]];
+            this->splits[token] = mergeTable.split(token);
+            this->outputIds[token] = mergeTable.outputId(token);
+        }
+
+        this->compiled = true;
+        return true;
+    }
+
+    bool BPEAutomaton::isValidTokenPair(const MergeTable &mergeTable, uint32_t token1, uint32_t token2) const
+    {
+        // Unwinds the merges of token1 from the right and of token2 from the left, checking that BPE
+        // never had a higher priority merge across the boundary than the ones that built both tokens
+        uint32_t limit = UINT32_MAX;
+        uint32_t combined;
+        while (true)
+        {
+            if (mergeTable.lookup(token1, token2, combined) != MergeTable::noRank && combined < limit)
+            {
+                return false;
+            }
+
+            if (token1 > token2)
+            {
+                limit = token1;
+                token1 = this->splits[token1].second;
+                if (token1 == limit)
+                {
+                    limit = token2 + 1;
+                    token2 = this->splits[token2].first;
+                    if (token2 + 1 == limit)
+                    {
+                        return true;
+                    }
+                }
+            }
+            else
+            {
+                limit = token2 + 1;
+                token2 = this->splits[token2].first;
+                if (token2 + 1 == limit)
+                {
+                    limit = token1;
+                    token1 = this->splits[token1].second;
+                    if (token1 == limit)
+                    {
+                        return true;
+                    }
+                }
+            }
+        }
+    }
+
+    void BPEAutomaton::encodeWord(std::string_view word, const MergeTable &mergeTable, std::vector<unsigned short> &output) const
+    {
+        // lastToken[i] is the last token of the encoding of word[0, i]
+        thread_local std::vector<uint32_t> lastToken;
+        lastToken.resize(word.size());
+
+        uint32_t state = 0;
+        for (size_t i = 0; i < word.size(); i++)
+        {
+            state = this->transition(state, static_cast<unsigned char>(word[i]));
+            uint32_t token = this->longestMatch[state];
+            while (token != noToken)
+            {
+                size_t start = i + 1 - this->tokenLength[token];
+                if (start == 0 || this->isValidTokenPair(mergeTable, lastToken[start - 1], token))
+                {
+                    break;
+                }
+                token = this->nextShorter[token];
+            }
+
+            if (token == noToken)
+            {
+                // Cannot happen for rules accepted by compile(), kept as a safety net
+                mergeTable.encodeWord(word, output);
+                return;
+            }
+            lastToken[i] = token;
+        }
+
+        size_t begin = output.size();
+        for (size_t position = word.size(); position > 0; position -= this->tokenLength[lastToken[position - 1]])
+        {
+            output.push_back(this->outputIds[lastToken[position - 1]]);
+        }
+        std::reverse(output.begin() + begin, output.end());
+    }
+}
@@ -0,0 +1,118 @@
+#include <dokusha.h>
+#include <bpe.h>
+#include <cstring>
+#include <spanstream>
+
+struct dokusha_tokenizer
+{
+    dokusha::BPETokenizer<std::string> tokenizer;
+};
+
+namespace
+{
+    dokusha_tokenizer *loadFrom(std::istream &inFile)
+    {
+        try
+        {
+            auto *handle = new dokusha_tokenizer();
+            if (!handle->tokenizer.load(inFile))
+            {
+                delete handle;
+                return nullptr;
+            }
+            return handle;
+        }
+        catch (...)
+        {
+            return nullptr;
+        }
+    }
+}
+
+extern "C"
+{
+    dokusha_tokenizer *dokusha_load(const char *path)
+    {
+        std::ifstream inFile(path, std::ios::binary);
+        return inFile ? loadFrom(inFile) : nullptr;
+    }
+
+    dokusha_tokenizer *dokusha_load_from_memory(const void *data, size_t size)
+    {
+        // The stream only reads, the const_cast just satisfies ispanstream's constructor
+        std::ispanstream inStream(std::span<char>(const_cast<char *>(static_cast<const char *>(data)), size), std::ios::binary);
+        return loadFrom(inStream);
+    }
+
+    void dokusha_free(dokusha_tokenizer *tokenizer)
+    {
+        delete tokenizer;
+    }
+
+    size_t dokusha_encode(const dokusha_tokenizer *tokenizer, const char *text, size_t length, uint16_t *tokens, size_t capacity)
+    {
+        try
+        {
+            // Reused per thread, so steady-state calls do not allocate
+            thread_local std::vector<unsigned short> encoded;
+            encoded.clear();
+            tokenizer->tokenizer.encodeSpan(trimmedView(std::string_view(text, length)), encoded);
+            std::memcpy(tokens, encoded.data(), std::min(encoded.size(), capacity) * sizeof(uint16_t));
+            return encoded.size();
+        }
+        catch (...)
+        {
+            return 0;
+        }
+    }
+
+    size_t dokusha_merge_count(const dokusha_tokenizer *tokenizer)
+    {
+        return tokenizer->tokenizer.getMergeRuleCount();
+    }
+
+    size_t dokusha_encode_with_merge_limit(const dokusha_tokenizer *tokenizer, const char *text, size_t length, uint16_t *tokens,
+                                           size_t capacity, size_t merge_limit)
+    {
+        try
+        {
+            thread_local std::vector<unsigned short> encoded;
+            encoded.clear();
+            tokenizer->tokenizer.encodeSpan(trimmedView(std::string_view(text, length)), encoded, merge_limit);
+            std::memcpy(tokens, encoded.data(), std::min(encoded.size(), capacity) * sizeof(uint16_t));
+            return encoded.size();
+        }
+        catch (...)
+        {
+            return 0;
+        }
+    }
+
+    size_t dokusha_decode_with_merge_limit(const dokusha_tokenizer *tokenizer, const uint16_t *tokens, size_t count, char *text,
+                                           size_t capacity, size_t merge_limit)
+    {
+        for (size_t i = 0; i < count; i++)
+        {
+            if (!tokenizer->tokenizer.isValidTokenId(tokens[i], merge_limit))
+            {
+                return DOKUSHA_INVALID_TOKENS;
+            }
+        }
+        return dokusha_decode(tokenizer, tokens, count, text, capacity);
+    }
+
+    size_t dokusha_decode(const dokusha_tokenizer *tokenizer, const uint16_t *tokens, size_t count, char *text, size_t capacity)
+    {
+        size_t length = 0;
+        for (size_t i = 0; i < count; i++)
+        {
+            std::string_view token = tokenizer->tokenizer.tokenBytes(tokens[i]);
+            if (length < capacity)
+            {
+                std::memcpy(text + length, token.data(), std::min(token.size(), capacity - length));
+            }
+            length += token.size();
+        }
+        return length;
+    }
+}
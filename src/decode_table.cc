@@ -0,0 +1,98 @@
+#include <decode_table.h>
+#include <memory_usage.h>
+#include <algorithm>
+#include <cstring>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+namespace dokusha
+{
+    size_t DecodeTable::memoryUsage() const
+    {
+        return memory::heapBytes(this->arena) + memory::heapBytes(this->offsets) + memory::heapBytes(this->lengths);
+    }
+
+    void DecodeTable::build(const std::unordered_map<unsigned short, std::string> &inverseVocabulary,
+                            const std::unordered_map<unsigned short, std::string> &specialTokens)
+    {
+        size_t numIds = 0;
+        size_t arenaSize = 0;
+        for (const auto *tokens : {&inverseVocabulary, &specialTokens})
+        {
+            for (const auto &[tokenId, token] : *tokens)
+            {
+                numIds = std::max<size_t>(numIds, tokenId + 1);
+                arenaSize += token.size();
+            }
+        }
+
+        this->offsets.assign(numIds, 0);
+        this->lengths.assign(numIds, 0);
+        this->arena.clear();
+        this->arena.reserve(arenaSize + padding);
+
+        // Lay tokens out in ID order, so decoding runs of nearby IDs touches nearby memory
+        for (size_t tokenId = 0; tokenId < numIds; tokenId++)
+        {
+            auto tokenIter = inverseVocabulary.find(static_cast<unsigned short>(tokenId));
+            if (tokenIter == inverseVocabulary.end())
+            {
+                tokenIter = specialTokens.find(static_cast<unsigned short>(tokenId));
+                if (tokenIter == specialTokens.end())
+                {
+                    continue;
+                }
+            }
+            this->offsets[tokenId] = this->arena.size();
+            this->lengths[tokenId] = tokenIter->second.size();
+            this->arena.insert(this->arena.end(), tokenIter->second.begin(), tokenIter->second.end());
+        }
+        this->arena.resize(arenaSize + padding, 0);
+
+        this->numTokens = inverseVocabulary.size() + specialTokens.size();
+        this->compiled = true;
+    }
+
+    size_t DecodeTable::decodedLength(const unsigned short *tokens, size_t numTokens) const
+    {
+        const size_t numIds = this->lengths.size();
+        size_t total = 0;
+        for (size_t i = 0; i < numTokens; i++)
+        {
+            total += tokens[i] < numIds ? this->lengths[tokens[i]] : 0;
+        }
+        return total;
+    }
+
+    void DecodeTable::decode(const unsigned short *tokens, size_t numTokens, std::string &output) const
+    {
+        const size_t begin = output.size();
+        const size_t total = this->decodedLength(tokens, numTokens);
+        const size_t numIds = this->lengths.size();
+
+        output.resize_and_overwrite(begin + total + padding, [&](char *buffer, size_t)
+        {
+            char *destination = buffer + begin;
+            for (size_t i = 0; i < numTokens; i++)
+            {
+                if (tokens[i] >= numIds)
+                {
+                    continue;
+                }
+                const char *source = this->arena.data() + this->offsets[tokens[i]];
+                const uint32_t length = this->lengths[tokens[i]];
+                for (uint32_t copied = 0; copied < length; copied += 16)
+                {
+#ifdef __SSE2__
+                    _mm_storeu_si128(reinterpret_cast<__m128i *>(destination + copied), _mm_loadu_si128(reinterpret_cast<const __m128i *>(source + copied)));
+#else
+                    std::memcpy(destination + copied, source + copied, 16);
+#endif
+                }
+                destination += length;
+            }
+            return begin + total;
+        });
+    }
+}
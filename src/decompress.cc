@@ -0,0 +1,216 @@
+#include <decompress.h>
+#include <fstream>
+#include <memory>
+#include <stdexcept>
+#include <zlib.h>
+#ifdef DOKUSHA_WITH_ZSTD
+#include <zstd.h>
+#endif
+
+namespace dokusha
+{
+    namespace
+    {
+        bool endsWith(const std::string &str, const std::string &suffix)
+        {
+            return str.size() >= suffix.size() && str.compare(str.size() - suffix.size(), suffix.size(), suffix) == 0;
+        }
+    }
+
+    Compression detectCompression(const std::string &path)
+    {
+        if (endsWith(path, ".gz"))
+        {
+            return Compression::Gzip;
+        }
+        if (endsWith(path, ".zst") || endsWith(path, ".zstd"))
+        {
+            return Compression::Zstd;
+        }
+        return Compression::None;
+    }
+
+    DecompressingReader::DecompressingReader(const std::string &path, size_t blockSize, size_t queueCapacity)
+        : blocks(queueCapacity), position(0)
+    {
+#ifndef DOKUSHA_WITH_ZSTD
+        if (detectCompression(path) == Compression::Zstd)
+        {
+            throw std::runtime_error("Built without zstd support, cannot read " + path);
+        }
+#endif
+        this->worker = std::thread(&DecompressingReader::run, this, path, detectCompression(path), blockSize);
+    }
+
+    DecompressingReader::~DecompressingReader()
+    {
+        // Unblocks the decompression thread if the consumer stopped before the end of the file
+        this->blocks.close();
+        this->worker.join();
+    }
+
+    void DecompressingReader::run(const std::string path, Compression compression, size_t blockSize)
+    {
+        try
+        {
+            std::string block;
+
+            if (compression == Compression::Gzip)
+            {
+                std::unique_ptr<gzFile_s, int (*)(gzFile)> file(gzopen(path.c_str(), "rb"), gzclose);
+                if (!file)
+                {
+                    throw std::runtime_error("Unable to open " + path);
+                }
+                gzbuffer(file.get(), 1 << 17);
+
+                while (true)
+                {
+                    block.resize(blockSize);
+                    int count = gzread(file.get(), &block[0], static_cast<unsigned>(blockSize));
+                    if (count < 0)
+                    {
+                        int errorCode;
+                        throw std::runtime_error(gzerror(file.get(), &errorCode));
+                    }
+                    if (count == 0)
+                    {
+                        // gzread reports a stream that ends early only through the error state, whose message names the file
+                        int errorCode;
+                        const char *message = gzerror(file.get(), &errorCode);
+                        if (errorCode != Z_OK)
+                        {
+                            throw std::runtime_error(message);
+                        }
+                        break;
+                    }
+                    block.resize(count);
+                    if (!this->blocks.push(std::move(block)))
+                    {
+                        break;
+                    }
+                }
+            }
+#ifdef DOKUSHA_WITH_ZSTD
+            else if (compression == Compression::Zstd)
+            {
+                std::ifstream inFile(path, std::ios::binary);
+                if (!inFile)
+                {
+                    throw std::runtime_error("Unable to open " + path);
+                }
+                std::unique_ptr<ZSTD_DCtx, size_t (*)(ZSTD_DCtx *)> context(ZSTD_createDCtx(), ZSTD_freeDCtx);
+                std::string input(ZSTD_DStreamInSize(), '\0');
+                bool stopped = false;
+                // 0 once a frame is completely decoded and flushed
+                size_t result = 0;
+                bool outputFull = false;
+
+                while (!stopped)
+                {
+                    inFile.read(&input[0], input.size());
+                    ZSTD_inBuffer inBuffer{input.data(), static_cast<size_t>(inFile.gcount()), 0};
+                    bool endOfInput = inBuffer.size == 0;
+
+                    // A call that fills the block may leave decoded data behind even with all input consumed, so
+                    // the decoder is drained until it leaves room, also once the input has ended
+                    while (!stopped && (inBuffer.pos < inBuffer.size || (outputFull && result != 0)))
+                    {
+                        block.resize(blockSize);
+                        ZSTD_outBuffer outBuffer{&block[0], block.size(), 0};
+                        result = ZSTD_decompressStream(context.get(), &outBuffer, &inBuffer);
+                        if (ZSTD_isError(result))
+                        {
+                            throw std::runtime_error(path + ": " + ZSTD_getErrorName(result));
+                        }
+                        outputFull = outBuffer.pos == outBuffer.size;
+                        block.resize(outBuffer.pos);
+                        if (!block.empty() && !this->blocks.push(std::move(block)))
+                        {
+                            stopped = true;
+                        }
+                    }
+
+                    if (endOfInput)
+                    {
+                        if (!stopped && result != 0)
+                        {
+                            throw std::runtime_error(path + ": truncated zstd frame");
+                        }
+                        break;
+                    }
+                }
+            }
+#endif
+            else
+            {
+                std::ifstream inFile(path, std::ios::binary);
+                if (!inFile)
+                {
+                    throw std::runtime_error("Unable to open " + path);
+                }
+                while (inFile)
+                {
+                    block.resize(blockSize);
+                    inFile.read(&block[0], blockSize);
+                    block.resize(inFile.gcount());
+                    if (block.empty() || !this->blocks.push(std::move(block)))
+                    {
+                        break;
+                    }
+                }
+            }
+        }
+        catch (...)
+        {
+            this->error = std::current_exception();
+        }
+        this->blocks.close();
+    }
+
+    bool DecompressingReader::readBlock(std::string &block)
+    {
+        if (this->position < this->current.size())
+        {
+            block.assign(this->current, this->position);
+            this->current.clear();
+            this->position = 0;
+            return true;
+        }
+
+        auto next = this->blocks.pop();
+        if (!next)
+        {
+            if (this->error)
+            {
+                std::rethrow_exception(this->error);
+            }
+            return false;
+        }
+        block = std::move(*next);
+        return true;
+    }
+
+    bool DecompressingReader::getline(std::string &line)
+    {
+        line.clear();
+        while (true)
+        {
+            size_t newline = this->current.find('\n', this->position);
+            if (newline != std::string::npos)
+            {
+                line.append(this->current, this->position, newline - this->position);
+                this->position = newline + 1;
+                return true;
+            }
+            line.append(this->current, this->position);
+            this->current.clear();
+            this->position = 0;
+
+            if (!this->readBlock(this->current))
+            {
+                return !line.empty();
+            }
+        }
+    }
+}
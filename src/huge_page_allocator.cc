@@ -0,0 +1,283 @@
+#include <huge_page_allocator.h>
+#include <memory_usage.h>
+#include <array>
+#include <atomic>
+#include <cassert>
+#include <cstdlib>
+#include <mutex>
+#include <new>
+#include <sstream>
+#include <sys/mman.h>
+#include <unordered_map>
+
+namespace dokusha::hugepages
+{
+    namespace
+    {
+        constexpr size_t hugePageBytes = 2 << 20;
+        constexpr size_t regionBytes = 16 << 20; // Of the regions small blocks are carved from
+        constexpr size_t smallBlockLimit = 512;
+        constexpr size_t sizeClassBytes = 16;
+        constexpr size_t numSizeClasses = smallBlockLimit / sizeClassBytes;
+
+        enum class Backing
+        {
+            HugeTLB,
+            Transparent,
+            Regular
+        };
+
+        // -1 until the first allocation fixes the mode
+        std::atomic<int> fixedMode{-1};
+        std::atomic<int> requestedMode{-1};
+        std::array<std::atomic<uint64_t>, 3> mappedBytes{};
+
+        HugePageMode currentMode()
+        {
+            int mode = fixedMode.load(std::memory_order_acquire);
+            if (mode >= 0)
+            {
+                return static_cast<HugePageMode>(mode);
+            }
+            int requested = requestedMode.load();
+            if (requested < 0)
+            {
+                const char *name = std::getenv("DOKUSHA_HUGE_PAGES");
+                requested = static_cast<int>(parseMode(name == nullptr ? "" : name, HugePageMode::Off));
+            }
+            fixedMode.compare_exchange_strong(mode, requested, std::memory_order_acq_rel);
+            return static_cast<HugePageMode>(fixedMode.load(std::memory_order_acquire));
+        }
+
+        // Maps bytes (a multiple of hugePageBytes) aligned to a huge page, so that the kernel can back all of it
+        // with huge pages
+        void *mapRegion(size_t bytes, Backing &backing)
+        {
+            HugePageMode mode = currentMode();
+            if (mode == HugePageMode::HugeTLB)
+            {
+                void *region = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+                if (region != MAP_FAILED)
+                {
+                    backing = Backing::HugeTLB;
+                    mappedBytes[static_cast<size_t>(backing)] += bytes;
+                    return region;
+                }
+            }
+
+            void *mapping = mmap(nullptr, bytes + hugePageBytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            if (mapping == MAP_FAILED)
+            {
+                throw std::bad_alloc();
+            }
+            uintptr_t start = reinterpret_cast<uintptr_t>(mapping);
+            uintptr_t aligned = (start + hugePageBytes - 1) & ~(hugePageBytes - 1);
+            if (aligned > start)
+            {
+                munmap(mapping, aligned - start);
+            }
+            if (aligned + bytes < start + bytes + hugePageBytes)
+            {
+                munmap(reinterpret_cast<void *>(aligned + bytes), start + hugePageBytes - aligned);
+            }
+
+            void *region = reinterpret_cast<void *>(aligned);
+            backing = Backing::Regular;
+            if (mode != HugePageMode::Off && madvise(region, bytes, MADV_HUGEPAGE) == 0)
+            {
+                backing = Backing::Transparent;
+            }
+            mappedBytes[static_cast<size_t>(backing)] += bytes;
+            return region;
+        }
+
+        struct FreeBlock
+        {
+            FreeBlock *next;
+        };
+
+        // Lists of blocks freed by threads that have exited, taken over by the next thread that runs out of room
+        std::mutex depotMutex;
+        std::array<FreeBlock *, numSizeClasses> depot{};
+
+        struct ThreadCache
+        {
+            std::array<FreeBlock *, numSizeClasses> freeLists{};
+            char *cursor = nullptr;
+            char *end = nullptr;
+
+            ~ThreadCache()
+            {
+                std::lock_guard<std::mutex> lock(depotMutex);
+                for (size_t sizeClass = 0; sizeClass < numSizeClasses; sizeClass++)
+                {
+                    while (FreeBlock *block = this->freeLists[sizeClass])
+                    {
+                        this->freeLists[sizeClass] = block->next;
+                        block->next = depot[sizeClass];
+                        depot[sizeClass] = block;
+                    }
+                }
+            }
+        };
+
+        thread_local ThreadCache cache;
+
+        void *allocateSmall(size_t sizeClass)
+        {
+            if (FreeBlock *block = cache.freeLists[sizeClass])
+            {
+                cache.freeLists[sizeClass] = block->next;
+                return block;
+            }
+
+            size_t bytes = (sizeClass + 1) * sizeClassBytes;
+            if (cache.cursor == nullptr || static_cast<size_t>(cache.end - cache.cursor) < bytes)
+            {
+                {
+                    std::lock_guard<std::mutex> lock(depotMutex);
+                    if (FreeBlock *block = depot[sizeClass])
+                    {
+                        cache.freeLists[sizeClass] = block->next;
+                        depot[sizeClass] = nullptr;
+                        return block;
+                    }
+                }
+                // The rest of the old region is abandoned, at most one block's worth
+                Backing backing;
+                cache.cursor = static_cast<char *>(mapRegion(regionBytes, backing));
+                cache.end = cache.cursor + regionBytes;
+            }
+            void *block = cache.cursor;
+            cache.cursor += bytes;
+            return block;
+        }
+
+        struct LargeRegion
+        {
+            size_t bytes;
+            Backing backing;
+        };
+        std::mutex largeRegionsMutex;
+        std::unordered_map<void *, LargeRegion> largeRegions;
+    }
+
+    bool setMode(HugePageMode mode)
+    {
+        if (fixedMode.load() < 0)
+        {
+            requestedMode.store(static_cast<int>(mode));
+        }
+        return currentMode() == mode;
+    }
+
+    HugePageMode mode()
+    {
+        return currentMode();
+    }
+
+    HugePageMode parseMode(const std::string &name, HugePageMode fallback)
+    {
+        if (name == "off")
+        {
+            return HugePageMode::Off;
+        }
+        if (name == "thp")
+        {
+            return HugePageMode::Transparent;
+        }
+        if (name == "hugetlb")
+        {
+            return HugePageMode::HugeTLB;
+        }
+        return fallback;
+    }
+
+    const char *modeName(HugePageMode mode)
+    {
+        switch (mode)
+        {
+        case HugePageMode::Transparent:
+            return "thp";
+        case HugePageMode::HugeTLB:
+            return "hugetlb";
+        default:
+            return "off";
+        }
+    }
+
+    Usage usage()
+    {
+        return Usage{mappedBytes[static_cast<size_t>(Backing::HugeTLB)].load(), mappedBytes[static_cast<size_t>(Backing::Transparent)].load(),
+                     mappedBytes[static_cast<size_t>(Backing::Regular)].load()};
+    }
+
+    std::string toJson()
+    {
+        Usage mapped = usage();
+        std::ostringstream json;
+        json << "{\"mode\":\"" << modeName(mode()) << "\",\"hugetlb_bytes\":" << mapped.hugeTlbBytes << ",\"transparent_bytes\":" << mapped.transparentBytes
+             << ",\"regular_bytes\":" << mapped.regularBytes << "}";
+        return json.str();
+    }
+
+    void *allocate(size_t bytes)
+    {
+        if (currentMode() == HugePageMode::Off || (bytes > smallBlockLimit && bytes < hugePageBytes))
+        {
+            return ::operator new(bytes);
+        }
+        if (bytes <= smallBlockLimit)
+        {
+            return allocateSmall(bytes == 0 ? 0 : (bytes - 1) / sizeClassBytes);
+        }
+
+        LargeRegion region{(bytes + hugePageBytes - 1) & ~(hugePageBytes - 1), Backing::Regular};
+        void *pointer = mapRegion(region.bytes, region.backing);
+        std::lock_guard<std::mutex> lock(largeRegionsMutex);
+        largeRegions.emplace(pointer, region);
+        return pointer;
+    }
+
+    void deallocate(void *pointer, size_t bytes)
+    {
+        if (currentMode() == HugePageMode::Off || (bytes > smallBlockLimit && bytes < hugePageBytes))
+        {
+            ::operator delete(pointer);
+            return;
+        }
+        if (bytes <= smallBlockLimit)
+        {
+            // Kept by the freeing thread for its own next allocations, the region is not told
+            size_t sizeClass = bytes == 0 ? 0 : (bytes - 1) / sizeClassBytes;
+            FreeBlock *block = static_cast<FreeBlock *>(pointer);
+            block->next = cache.freeLists[sizeClass];
+            cache.freeLists[sizeClass] = block;
+            return;
+        }
+
+        LargeRegion region;
+        {
+            std::lock_guard<std::mutex> lock(largeRegionsMutex);
+            auto found = largeRegions.find(pointer);
+            assert(found != largeRegions.end() && "Block of 2 MB or more not allocated by hugepages::allocate");
+            region = found->second;
+            largeRegions.erase(found);
+        }
+        mappedBytes[static_cast<size_t>(region.backing)] -= region.bytes;
+        munmap(pointer, region.bytes);
+    }
+
+    size_t blockBytes(size_t bytes)
+    {
+        if (currentMode() == HugePageMode::Off || (bytes > smallBlockLimit && bytes < hugePageBytes))
+        {
+            return memory::mallocChunk(bytes);
+        }
+        if (bytes <= smallBlockLimit)
+        {
+            return std::max<size_t>(1, (bytes + sizeClassBytes - 1) / sizeClassBytes) * sizeClassBytes;
+        }
+        return (bytes + hugePageBytes - 1) & ~(hugePageBytes - 1);
+    }
+}
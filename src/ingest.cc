@@ -0,0 +1,206 @@
+#include <ingest.h>
+#include <decompress.h>
+#include <trace.h>
+#include <chrono>
+#include <cstring>
+#include <filesystem>
+#include <stdexcept>
+
+using recursive_directory_iterator = std::filesystem::recursive_directory_iterator;
+
+namespace dokusha
+{
+    namespace
+    {
+        // Returns the offset just past the first newline at or after position, or fileSize if there is none
+        uint64_t nextLineStart(std::ifstream &inFile, uint64_t position, uint64_t fileSize)
+        {
+            char window[4096];
+            inFile.clear();
+            inFile.seekg(position);
+            while (position < fileSize)
+            {
+                inFile.read(window, sizeof(window));
+                std::streamsize count = inFile.gcount();
+                if (count <= 0)
+                {
+                    break;
+                }
+                const char *newline = static_cast<const char *>(std::memchr(window, '\n', count));
+                if (newline != nullptr)
+                {
+                    return position + (newline - window) + 1;
+                }
+                position += count;
+            }
+            return fileSize;
+        }
+
+        void ingestCompressedFile(const CorpusChunk &chunk, BPETokenizer<std::string> &tokenizer, IngestWorkerStats &stats)
+        {
+            DecompressingReader reader(chunk.path);
+            std::string line;
+            unsigned lineIndex = 0;
+
+            while (reader.getline(line))
+            {
+                lineIndex++;
+                stats.bytes += line.size() + 1;
+                if (lineIndex > chunk.skipLines)
+                {
+                    tokenizer.addToCorpus(line);
+                }
+            }
+
+            stats.chunks++;
+            stats.lines += lineIndex;
+        }
+
+        void ingestChunk(const CorpusChunk &chunk, BPETokenizer<std::string> &tokenizer, IngestWorkerStats &stats)
+        {
+            DOKUSHA_TRACE_SCOPE("ingestChunk");
+            if (detectCompression(chunk.path) != Compression::None)
+            {
+                ingestCompressedFile(chunk, tokenizer, stats);
+                return;
+            }
+
+            std::ifstream fio(chunk.path, std::ios::binary);
+            if (!fio)
+            {
+                throw std::runtime_error("Unable to open " + chunk.path);
+            }
+            std::string buffer(chunk.end - chunk.begin, '\0');
+            fio.seekg(chunk.begin);
+            fio.read(&buffer[0], buffer.size());
+            buffer.resize(fio.gcount());
+
+            std::string line;
+            unsigned lineIndex = 0;
+            size_t begin = 0;
+            while (begin < buffer.size())
+            {
+                size_t end = buffer.find('\n', begin);
+                if (end == std::string::npos)
+                {
+                    end = buffer.size();
+                }
+
+                lineIndex++;
+                if (lineIndex > chunk.skipLines)
+                {
+                    line.assign(buffer, begin, end - begin);
+                    tokenizer.addToCorpus(line);
+                }
+                begin = end + 1;
+            }
+
+            stats.chunks++;
+            stats.bytes += buffer.size();
+            stats.lines += lineIndex;
+        }
+    }
+
+    std::vector<CorpusChunk> planCorpusChunks(const std::string &corpusPath, uint64_t chunkSize, unsigned skipLines)
+    {
+        std::vector<CorpusChunk> chunks;
+
+        for (const auto &textFile : recursive_directory_iterator(corpusPath))
+        {
+            if (!textFile.is_regular_file())
+            {
+                continue;
+            }
+            uint64_t fileSize = textFile.file_size();
+            std::string path = textFile.path().string();
+
+            // Compressed streams cannot be entered mid-way, so they are always ingested whole
+            if (fileSize <= chunkSize || detectCompression(path) != Compression::None)
+            {
+                chunks.push_back(CorpusChunk{path, 0, fileSize, skipLines});
+                continue;
+            }
+
+            std::ifstream inFile(path, std::ios::binary);
+            uint64_t begin = 0;
+            while (begin < fileSize)
+            {
+                uint64_t end = begin + chunkSize < fileSize ? nextLineStart(inFile, begin + chunkSize, fileSize) : fileSize;
+                chunks.push_back(CorpusChunk{path, begin, end, begin == 0 ? skipLines : 0});
+                begin = end;
+            }
+        }
+
+        std::stable_sort(chunks.begin(), chunks.end(), [](const CorpusChunk &lhs, const CorpusChunk &rhs)
+                         { return lhs.end - lhs.begin > rhs.end - rhs.begin; });
+        return chunks;
+    }
+
+    std::vector<IngestWorkerStats> ingestCorpus(const std::string &corpusPath, BPETokenizer<std::string> &tokenizer,
+                                                unsigned skipLines, uint64_t chunkSize)
+    {
+        std::vector<CorpusChunk> chunks = planCorpusChunks(corpusPath, chunkSize, skipLines);
+
+        const int numThreads = omp_get_max_threads();
+        std::vector<BPETokenizer<std::string>> workerTokenizers(numThreads);
+        for (auto &workerTokenizer : workerTokenizers)
+        {
+            workerTokenizer.setWordPartition(tokenizer.getWordPartition().first, tokenizer.getWordPartition().second);
+        }
+        std::vector<IngestWorkerStats> workerStats(numThreads);
+
+        // Chunks are sorted largest first, so dynamic scheduling hands out the longest jobs before the short ones
+#pragma omp parallel for schedule(dynamic, 1) num_threads(numThreads)
+        for (size_t i = 0; i < chunks.size(); i++)
+        {
+            const int worker = omp_get_thread_num();
+            auto start = std::chrono::steady_clock::now();
+            // An exception must not leave the parallel region, which would terminate the process
+            try
+            {
+                ingestChunk(chunks[i], workerTokenizers[worker], workerStats[worker]);
+            }
+            catch (const std::exception &error)
+            {
+                workerStats[worker].errors.push_back(error.what());
+            }
+            auto end = std::chrono::steady_clock::now();
+            workerStats[worker].seconds += std::chrono::duration<double>(end - start).count();
+        }
+
+        for (auto &workerTokenizer : workerTokenizers)
+        {
+            tokenizer.mergeCorpus(workerTokenizer);
+        }
+
+        return workerStats;
+    }
+
+    bool ingestFailed(const std::vector<IngestWorkerStats> &workerStats)
+    {
+        return std::any_of(workerStats.begin(), workerStats.end(), [](const IngestWorkerStats &stats)
+                           { return !stats.errors.empty(); });
+    }
+
+    void printIngestStats(const std::vector<IngestWorkerStats> &workerStats)
+    {
+        IngestWorkerStats total;
+        for (size_t worker = 0; worker < workerStats.size(); worker++)
+        {
+            const auto &stats = workerStats[worker];
+            std::cout << "[Worker " << worker << "] Chunks: " << stats.chunks << ", Lines: " << stats.lines
+                      << ", MB: " << stats.bytes / 1e6 << ", Time(s): " << stats.seconds
+                      << ", MB/s: " << (stats.seconds > 0 ? stats.bytes / 1e6 / stats.seconds : 0) << std::endl;
+            for (const auto &error : stats.errors)
+            {
+                std::cout << "[Worker " << worker << "] Failed: " << error << std::endl;
+            }
+            total.chunks += stats.chunks;
+            total.lines += stats.lines;
+            total.bytes += stats.bytes;
+            total.seconds = std::max(total.seconds, stats.seconds);
+        }
+        std::cout << "[Total] Chunks: " << total.chunks << ", Lines: " << total.lines << ", MB: " << total.bytes / 1e6
+                  << ", Slowest worker(s): " << total.seconds << std::endl;
+    }
+}
@@ -0,0 +1,179 @@
+#include <memory_usage.h>
+#include <huge_page_allocator.h>
+#include <atomic>
+#include <sstream>
+#ifdef DOKUSHA_COUNT_ALLOCATIONS
+#include <cstdlib>
+#include <malloc.h>
+#include <new>
+#endif
+
+namespace dokusha
+{
+    namespace
+    {
+        void writeStructures(std::ostream &json, const std::vector<StructureMemory> &structures)
+        {
+            json << "{";
+            for (size_t i = 0; i < structures.size(); i++)
+            {
+                json << (i > 0 ? "," : "") << "\"" << structures[i].name << "\":{\"elements\":" << structures[i].elements
+                     << ",\"bytes\":" << structures[i].bytes << "}";
+            }
+            json << "}";
+        }
+    }
+
+    size_t MemoryUsage::totalBytes() const
+    {
+        size_t total = 0;
+        for (const auto &structure : this->structures)
+        {
+            total += structure.bytes;
+        }
+        return total;
+    }
+
+    std::string MemoryUsage::toJson() const
+    {
+        std::ostringstream json;
+        json << "{\"total_bytes\":" << this->totalBytes() << ",\"structures\":";
+        writeStructures(json, this->structures);
+        if (memory::countingAllocatorEnabled())
+        {
+            json << ",\"allocated_bytes\":" << memory::allocatedBytes() << ",\"peak_allocated_bytes\":" << memory::peakAllocatedBytes();
+        }
+        if (hugepages::mode() != HugePageMode::Off)
+        {
+            hugepages::Usage mapped = hugepages::usage();
+            json << ",\"huge_page_mapped_bytes\":" << mapped.hugeTlbBytes + mapped.transparentBytes + mapped.regularBytes;
+        }
+        json << "}";
+        return json.str();
+    }
+
+    void MemoryPeak::update(const MemoryUsage &usage)
+    {
+        this->updates++;
+        if (usage.totalBytes() > this->totalBytes)
+        {
+            this->totalBytes = usage.totalBytes();
+            this->totalUpdate = this->updates;
+        }
+        for (const auto &structure : usage.structures)
+        {
+            auto peak = std::find_if(this->peaks.structures.begin(), this->peaks.structures.end(),
+                                     [&structure](const StructureMemory &existing) { return existing.name == structure.name; });
+            if (peak == this->peaks.structures.end())
+            {
+                this->peaks.structures.push_back(structure);
+            }
+            else if (structure.bytes > peak->bytes)
+            {
+                *peak = structure;
+            }
+        }
+    }
+
+    std::string MemoryPeak::toJson() const
+    {
+        std::ostringstream json;
+        json << "{\"updates\":" << this->updates << ",\"peak_total_bytes\":" << this->totalBytes
+             << ",\"peak_total_update\":" << this->totalUpdate << ",\"structures\":";
+        writeStructures(json, this->peaks.structures);
+        if (memory::countingAllocatorEnabled())
+        {
+            json << ",\"peak_allocated_bytes\":" << memory::peakAllocatedBytes();
+        }
+        json << "}";
+        return json.str();
+    }
+
+    namespace memory
+    {
+#ifdef DOKUSHA_COUNT_ALLOCATIONS
+        namespace
+        {
+            std::atomic<uint64_t> liveBytes{0};
+            std::atomic<uint64_t> peakBytes{0};
+
+            void *allocate(size_t size, size_t alignment)
+            {
+                size = size == 0 ? 1 : size;
+                void *pointer = alignment <= __STDCPP_DEFAULT_NEW_ALIGNMENT__
+                                    ? std::malloc(size)
+                                    : std::aligned_alloc(alignment, (size + alignment - 1) & ~(alignment - 1));
+                if (pointer != nullptr)
+                {
+                    size_t usable = malloc_usable_size(pointer);
+                    uint64_t live = liveBytes.fetch_add(usable, std::memory_order_relaxed) + usable;
+                    uint64_t peak = peakBytes.load(std::memory_order_relaxed);
+                    while (live > peak && !peakBytes.compare_exchange_weak(peak, live, std::memory_order_relaxed))
+                    {
+                    }
+                }
+                return pointer;
+            }
+
+            void release(void *pointer)
+            {
+                if (pointer != nullptr)
+                {
+                    liveBytes.fetch_sub(malloc_usable_size(pointer), std::memory_order_relaxed);
+                    std::free(pointer);
+                }
+            }
+
+            void *allocateOrThrow(size_t size, size_t alignment)
+            {
+                while (true)
+                {
+                    if (void *pointer = allocate(size, alignment))
+                    {
+                        return pointer;
+                    }
+                    std::new_handler handler = std::get_new_handler();
+                    if (handler == nullptr)
+                    {
+                        throw std::bad_alloc();
+                    }
+                    handler();
+                }
+            }
+        }
+
+        bool countingAllocatorEnabled() { return true; }
+        uint64_t allocatedBytes() { return liveBytes.load(std::memory_order_relaxed); }
+        uint64_t peakAllocatedBytes() { return peakBytes.load(std::memory_order_relaxed); }
+        void resetPeak() { peakBytes.store(liveBytes.load(std::memory_order_relaxed), std::memory_order_relaxed); }
+#else
+        bool countingAllocatorEnabled() { return false; }
+        uint64_t allocatedBytes() { return 0; }
+        uint64_t peakAllocatedBytes() { return 0; }
+        void resetPeak() {}
+#endif
+    }
+}
+
+#ifdef DOKUSHA_COUNT_ALLOCATIONS
+void *operator new(size_t size) { return dokusha::memory::allocateOrThrow(size, __STDCPP_DEFAULT_NEW_ALIGNMENT__); }
+void *operator new[](size_t size) { return dokusha::memory::allocateOrThrow(size, __STDCPP_DEFAULT_NEW_ALIGNMENT__); }
+void *operator new(size_t size, std::align_val_t alignment) { return dokusha::memory::allocateOrThrow(size, static_cast<size_t>(alignment)); }
+void *operator new[](size_t size, std::align_val_t alignment) { return dokusha::memory::allocateOrThrow(size, static_cast<size_t>(alignment)); }
+void *operator new(size_t size, const std::nothrow_t &) noexcept { return dokusha::memory::allocate(size, __STDCPP_DEFAULT_NEW_ALIGNMENT__); }
+void *operator new[](size_t size, const std::nothrow_t &) noexcept { return dokusha::memory::allocate(size, __STDCPP_DEFAULT_NEW_ALIGNMENT__); }
+void *operator new(size_t size, std::align_val_t alignment, const std::nothrow_t &) noexcept { return dokusha::memory::allocate(size, static_cast<size_t>(alignment)); }
+void *operator new[](size_t size, std::align_val_t alignment, const std::nothrow_t &) noexcept { return dokusha::memory::allocate(size, static_cast<size_t>(alignment)); }
+void operator delete(void *pointer) noexcept { dokusha::memory::release(pointer); }
+void operator delete[](void *pointer) noexcept { dokusha::memory::release(pointer); }
+void operator delete(void *pointer, size_t) noexcept { dokusha::memory::release(pointer); }
+void operator delete[](void *pointer, size_t) noexcept { dokusha::memory::release(pointer); }
+void operator delete(void *pointer, std::align_val_t) noexcept { dokusha::memory::release(pointer); }
+void operator delete[](void *pointer, std::align_val_t) noexcept { dokusha::memory::release(pointer); }
+void operator delete(void *pointer, size_t, std::align_val_t) noexcept { dokusha::memory::release(pointer); }
+void operator delete[](void *pointer, size_t, std::align_val_t) noexcept { dokusha::memory::release(pointer); }
+void operator delete(void *pointer, const std::nothrow_t &) noexcept { dokusha::memory::release(pointer); }
+void operator delete[](void *pointer, const std::nothrow_t &) noexcept { dokusha::memory::release(pointer); }
+void operator delete(void *pointer, std::align_val_t, const std::nothrow_t &) noexcept { dokusha::memory::release(pointer); }
+void operator delete[](void *pointer, std::align_val_t, const std::nothrow_t &) noexcept { dokusha::memory::release(pointer); }
+#endif
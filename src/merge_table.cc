@@ -0,0 +1,251 @@
+#include <merge_table.h>
+#include <memory_usage.h>
+#include <bit>
+
+namespace dokusha
+{
+    size_t MergeTable::memoryUsage() const
+    {
+        return memory::heapBytes(this->slots) + memory::heapBytes(this->outputIds) + memory::heapBytes(this->tokenStrings) +
+               memory::heapBytes(this->splits);
+    }
+
+    bool MergeTable::build(const std::vector<std::pair<std::pair<std::string, std::string>, std::string>> &rankedMergeRules,
+                           const std::unordered_map<std::string, unsigned short> &vocabulary)
+    {
+        this->compiled = false;
+        this->numRules = rankedMergeRules.size();
+
+        auto outputId = [&vocabulary](const std::string &token) -> unsigned short
+        {
+            auto vocabularyIter = vocabulary.find(token);
+            return vocabularyIter == vocabulary.end() ? 0 : vocabularyIter->second;
+        };
+
+        std::unordered_map<std::string, uint32_t> internalIds;
+        this->outputIds.clear();
+        this->tokenStrings.clear();
+        this->splits.clear();
+        for (unsigned byte = 0; byte < 256; byte++)
+        {
+            std::string token(1, static_cast<char>(byte));
+            internalIds.emplace(token, byte);
+            this->outputIds.push_back(outputId(token));
+            this->tokenStrings.push_back(token);
+            this->splits.emplace_back(byte, byte);
+        }
+
+        size_t capacity = std::bit_ceil(std::max<size_t>(16, 2 * rankedMergeRules.size()));
+        this->slots.assign(capacity, Slot{emptyKey, noRank, 0});
+        this->mask = capacity - 1;
+
+        for (uint32_t rank = 0; rank < rankedMergeRules.size(); rank++)
+        {
+            const auto &rule = rankedMergeRules[rank];
+            auto leftIter = internalIds.find(rule.first.first);
+            auto rightIter = internalIds.find(rule.first.second);
+            if (leftIter == internalIds.end() || rightIter == internalIds.end())
+            {
+                this->slots.clear();
+                return false;
+            }
+
+            // Rules producing an already known string share its internal token
+            auto merged = internalIds.emplace(rule.second, static_cast<uint32_t>(internalIds.size()));
+            if (merged.second)
+            {
+                this->outputIds.push_back(outputId(rule.second));
+                this->tokenStrings.push_back(rule.second);
+                this->splits.emplace_back(leftIter->second, rightIter->second);
+            }
+
+            uint64_t key = pairKey(leftIter->second, rightIter->second);
+            size_t index = this->slotIndex(key);
+            while (this->slots[index].key != emptyKey && this->slots[index].key != key)
+            {
+                index = (index + 1) & this->mask;
+            }
+            if (this->slots[index].key == emptyKey)
+            {
+                this->slots[index] = Slot{key, rank, merged.first->second};
+            }
+        }
+
+        this->compiled = true;
+        return true;
+    }
+
+    const MergeTable::Slot *MergeTable::find(uint32_t left, uint32_t right) const
+    {
+        uint64_t key = pairKey(left, right);
+        for (size_t index = this->slotIndex(key);; index = (index + 1) & this->mask)
+        {
+            const Slot &slot = this->slots[index];
+            if (slot.key == key)
+            {
+                return &slot;
+            }
+            if (slot.key == emptyKey)
+            {
+                return nullptr;
+            }
+        }
+    }
+
+    void MergeTable::prefetch(uint32_t left, uint32_t right) const
+    {
+        __builtin_prefetch(&this->slots[this->slotIndex(pairKey(left, right))]);
+    }
+
+    void MergeTable::WordState::start(std::string_view text, size_t wordIndex, uint32_t mergeLimit)
+    {
+        this->word = wordIndex;
+        this->floor = 0;
+        this->limit = mergeLimit;
+        this->tokens.assign(text.begin(), text.end());
+        for (auto &token : this->tokens)
+        {
+            token &= 0xFF; // char may be signed
+        }
+
+        size_t numPairs = this->tokens.empty() ? 0 : this->tokens.size() - 1;
+        this->ranks.assign(numPairs, noRank);
+        this->merges.assign(numPairs, 0);
+        this->pending.clear();
+        for (size_t i = 0; i < numPairs; i++)
+        {
+            this->pending.push_back(i);
+        }
+    }
+
+    void MergeTable::resolve(WordState &state) const
+    {
+        for (const auto &position : state.pending)
+        {
+            const Slot *slot = this->find(state.tokens[position], state.tokens[position + 1]);
+            state.ranks[position] = slot == nullptr ? noRank : slot->rank;
+            state.merges[position] = slot == nullptr ? 0 : slot->merged;
+        }
+        state.pending.clear();
+    }
+
+    bool MergeTable::step(WordState &state) const
+    {
+        // Ranks below the floor belong to rules that were already replayed before this pair existed
+        uint32_t bestRank = state.limit;
+        size_t bestPosition = 0;
+        for (size_t i = 0; i < state.ranks.size(); i++)
+        {
+            if (state.ranks[i] < bestRank && state.ranks[i] >= state.floor)
+            {
+                bestRank = state.ranks[i];
+                bestPosition = i;
+            }
+        }
+        if (bestRank == state.limit)
+        {
+            return false;
+        }
+
+        state.floor = bestRank;
+        state.tokens[bestPosition] = state.merges[bestPosition];
+        state.tokens.erase(state.tokens.begin() + bestPosition + 1);
+        state.ranks.erase(state.ranks.begin() + bestPosition);
+        state.merges.erase(state.merges.begin() + bestPosition);
+
+        if (bestPosition > 0)
+        {
+            state.pending.push_back(bestPosition - 1);
+        }
+        if (bestPosition < state.ranks.size())
+        {
+            state.pending.push_back(bestPosition);
+        }
+        return true;
+    }
+
+    void MergeTable::encodeWord(std::string_view word, std::vector<unsigned short> &output, uint32_t mergeLimit) const
+    {
+        WordState state;
+        state.start(word, 0, mergeLimit);
+        do
+        {
+            this->resolve(state);
+        } while (this->step(state));
+
+        for (const auto &token : state.tokens)
+        {
+            output.push_back(this->outputIds[token]);
+        }
+    }
+
+    void MergeTable::encodeWordInternal(std::string_view word, std::vector<uint32_t> &output) const
+    {
+        WordState state;
+        state.start(word, 0);
+        do
+        {
+            this->resolve(state);
+        } while (this->step(state));
+
+        output.insert(output.end(), state.tokens.begin(), state.tokens.end());
+    }
+
+    void MergeTable::encodeWords(const std::vector<std::string_view> &words, std::vector<unsigned short> &tokens,
+                                 std::vector<std::pair<size_t, size_t>> &spans, size_t groupSize) const
+    {
+        spans.assign(words.size(), {0, 0});
+        std::vector<WordState> lanes(std::min(std::max<size_t>(1, groupSize), words.size()));
+        size_t nextWord = 0;
+        size_t activeLanes = 0;
+
+        for (auto &lane : lanes)
+        {
+            lane.start(words[nextWord], nextWord);
+            nextWord++;
+            activeLanes++;
+        }
+
+        while (activeLanes > 0)
+        {
+            // Issue every lookup of the round before waiting on any of them
+            for (size_t i = 0; i < activeLanes; i++)
+            {
+                for (const auto &position : lanes[i].pending)
+                {
+                    this->prefetch(lanes[i].tokens[position], lanes[i].tokens[position + 1]);
+                }
+            }
+
+            for (size_t i = 0; i < activeLanes;)
+            {
+                WordState &lane = lanes[i];
+                this->resolve(lane);
+                if (this->step(lane))
+                {
+                    i++;
+                    continue;
+                }
+
+                spans[lane.word] = {tokens.size(), lane.tokens.size()};
+                for (const auto &token : lane.tokens)
+                {
+                    tokens.push_back(this->outputIds[token]);
+                }
+
+                if (nextWord < words.size())
+                {
+                    lane.start(words[nextWord], nextWord);
+                    nextWord++;
+                    i++;
+                }
+                else
+                {
+                    // Keep active lanes packed at the front
+                    std::swap(lane, lanes[activeLanes - 1]);
+                    activeLanes--;
+                }
+            }
+        }
+    }
+}
@@ -0,0 +1,430 @@
+#include <multiprocess_training.h>
+#include <ingest.h>
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <csignal>
+#include <new>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <thread>
+#include <unistd.h>
+
+namespace dokusha
+{
+    namespace
+    {
+        struct PairDelta
+        {
+            uint32_t pair; // Left token ID << 16 | right token ID
+            int64_t delta;
+        };
+
+        uint32_t pairKey(uint16_t left, uint16_t right)
+        {
+            return static_cast<uint32_t>(left) << 16 | right;
+        }
+
+        // Barrier for processes sharing the segment. Waiters poll instead of sleeping in the kernel, so
+        // that they notice a peer that died and will never arrive.
+        struct SharedBarrier
+        {
+            std::atomic<uint32_t> arrived{0};
+            std::atomic<uint32_t> generation{0};
+            uint32_t parties = 0;
+
+            template <typename Alive>
+            bool wait(Alive &&alive)
+            {
+                uint32_t current = this->generation.load(std::memory_order_acquire);
+                if (this->arrived.fetch_add(1, std::memory_order_acq_rel) + 1 == this->parties)
+                {
+                    this->arrived.store(0, std::memory_order_relaxed);
+                    this->generation.fetch_add(1, std::memory_order_release);
+                    return true;
+                }
+                for (unsigned spins = 0; this->generation.load(std::memory_order_acquire) == current; spins++)
+                {
+                    if (spins < 1000)
+                    {
+                        std::this_thread::yield();
+                        continue;
+                    }
+                    std::this_thread::sleep_for(std::chrono::microseconds(50));
+                    if (spins % 20 == 0 && !alive())
+                    {
+                        return false;
+                    }
+                }
+                return true;
+            }
+        };
+
+        enum class Command : uint32_t
+        {
+            Merge,
+            Stop
+        };
+
+        // Written by the coordinator, read by the workers after the barrier that follows
+        struct Control
+        {
+            SharedBarrier barrier;
+            std::atomic<uint32_t> aborted{0};
+            bool allDone = false;
+            Command command = Command::Merge;
+            uint16_t left = 0;
+            uint16_t right = 0;
+            uint16_t merged = 0;
+        };
+
+        // Written by its worker, read by the coordinator after the barrier that follows
+        struct WorkerSlot
+        {
+            uint64_t count = 0; // Entries sent in this round
+            bool done = false;  // Whether this round completes the worker's deltas of the current merge
+            uint64_t words = 0;
+        };
+
+        struct SharedSegment
+        {
+            void *memory = MAP_FAILED;
+            size_t size = 0;
+            Control *control = nullptr;
+            WorkerSlot *slots = nullptr;
+            PairDelta *entries = nullptr; // exchangeCapacity entries per worker
+
+            SharedSegment(unsigned workers, size_t exchangeCapacity)
+            {
+                size_t slotsOffset = (sizeof(Control) + 63) & ~size_t(63);
+                size_t entriesOffset = (slotsOffset + workers * sizeof(WorkerSlot) + 63) & ~size_t(63);
+                this->size = entriesOffset + workers * exchangeCapacity * sizeof(PairDelta);
+                this->memory = mmap(nullptr, this->size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+                if (this->memory == MAP_FAILED)
+                {
+                    return;
+                }
+                char *base = static_cast<char *>(this->memory);
+                this->control = new (base) Control();
+                this->control->barrier.parties = workers + 1;
+                this->slots = new (base + slotsOffset) WorkerSlot[workers]();
+                this->entries = reinterpret_cast<PairDelta *>(base + entriesOffset);
+            }
+
+            ~SharedSegment()
+            {
+                if (this->memory != MAP_FAILED)
+                {
+                    munmap(this->memory, this->size);
+                }
+            }
+        };
+
+        struct Word
+        {
+            std::vector<uint16_t> tokens;
+            uint32_t frequency;
+        };
+
+        void countPairs(const Word &word, int64_t sign, std::unordered_map<uint32_t, int64_t> &counts)
+        {
+            for (size_t i = 0; i + 1 < word.tokens.size(); i++)
+            {
+                counts[pairKey(word.tokens[i], word.tokens[i + 1])] += sign * word.frequency;
+            }
+        }
+
+        // Same left to right replacement as BPETokenizer::updateWordWiseTokenList, recording the pair count changes
+        void applyMerge(std::vector<Word> &words, uint16_t left, uint16_t right, uint16_t merged, std::unordered_map<uint32_t, int64_t> &deltas)
+        {
+            for (auto &word : words)
+            {
+                auto &tokens = word.tokens;
+                bool contains = false;
+                for (size_t i = 0; i + 1 < tokens.size() && !contains; i++)
+                {
+                    contains = tokens[i] == left && tokens[i + 1] == right;
+                }
+                if (!contains)
+                {
+                    continue;
+                }
+
+                countPairs(word, -1, deltas);
+                size_t kept = 0;
+                for (size_t i = 0; i < tokens.size(); i++)
+                {
+                    if (i + 1 < tokens.size() && tokens[i] == left && tokens[i + 1] == right)
+                    {
+                        tokens[kept++] = merged;
+                        i++;
+                    }
+                    else
+                    {
+                        tokens[kept++] = tokens[i];
+                    }
+                }
+                tokens.resize(kept);
+                countPairs(word, 1, deltas);
+            }
+        }
+
+        int runWorker(unsigned index, const std::string &corpusPath, const MultiProcessTrainingOptions &options,
+                      const std::array<uint16_t, 256> &byteIds, SharedSegment &segment, pid_t coordinator)
+        {
+            Control &control = *segment.control;
+            WorkerSlot &slot = segment.slots[index];
+            PairDelta *entries = segment.entries + index * options.exchangeCapacity;
+            auto alive = [&control, coordinator] { return getppid() == coordinator && control.aborted.load() == 0; };
+
+            // The workers share the machine, so each gets its share of the OpenMP threads for ingestion
+            omp_set_num_threads(std::max(1, omp_get_max_threads() / static_cast<int>(options.workers)));
+            std::vector<Word> words;
+            {
+                BPETokenizer<std::string> partition;
+                partition.setWordPartition(index, options.workers);
+                if (ingestFailed(ingestCorpus(corpusPath, partition, options.skipLines, options.chunkSize)))
+                {
+                    return 1;
+                }
+                partition.pruneWordList();
+                for (auto &[text, frequency] : partition.releaseCorpus())
+                {
+                    Word word{{}, frequency};
+                    for (const auto &byte : text)
+                    {
+                        word.tokens.push_back(byteIds[static_cast<unsigned char>(byte)]);
+                    }
+                    words.push_back(std::move(word));
+                }
+            }
+            slot.words = words.size();
+
+            std::unordered_map<uint32_t, int64_t> deltas;
+            for (const auto &word : words)
+            {
+                countPairs(word, 1, deltas);
+            }
+
+            std::vector<PairDelta> outgoing;
+            while (true)
+            {
+                outgoing.clear();
+                for (const auto &[pair, delta] : deltas)
+                {
+                    if (delta != 0)
+                    {
+                        outgoing.push_back(PairDelta{pair, delta});
+                    }
+                }
+                deltas.clear();
+
+                size_t sent = 0;
+                do
+                {
+                    size_t count = std::min(options.exchangeCapacity, outgoing.size() - sent);
+                    std::copy(outgoing.begin() + sent, outgoing.begin() + sent + count, entries);
+                    sent += count;
+                    slot.count = count;
+                    slot.done = sent == outgoing.size();
+                    // Once for the slots being filled, once for the coordinator having read them
+                    if (!control.barrier.wait(alive) || !control.barrier.wait(alive))
+                    {
+                        return 1;
+                    }
+                } while (!control.allDone);
+
+                if (!control.barrier.wait(alive))
+                {
+                    return 1;
+                }
+                if (control.command == Command::Stop)
+                {
+                    return 0;
+                }
+                applyMerge(words, control.left, control.right, control.merged, deltas);
+            }
+        }
+    }
+
+    bool trainMultiProcess(const std::string &corpusPath, BPETokenizer<std::string> &tokenizer,
+                           const std::vector<unsigned short> &vocabularySizes, const MultiProcessTrainingOptions &options,
+                           const std::function<void(unsigned short)> &onVocabularySize, MultiProcessTrainingStats &stats)
+    {
+        stats = MultiProcessTrainingStats{};
+        stats.workers = std::max(1u, options.workers);
+        MultiProcessTrainingOptions workerOptions = options;
+        workerOptions.workers = stats.workers;
+        workerOptions.exchangeCapacity = std::max<size_t>(1, options.exchangeCapacity);
+
+        std::vector<unsigned short> targets = vocabularySizes;
+        std::sort(targets.begin(), targets.end());
+        if (targets.empty())
+        {
+            return true;
+        }
+
+        std::array<uint16_t, 256> byteIds{};
+        for (unsigned byte = 0; byte < 256; byte++)
+        {
+            byteIds[byte] = tokenizer.tokenId(std::string(1, static_cast<char>(byte))).value_or(0);
+        }
+
+        SharedSegment segment(workerOptions.workers, workerOptions.exchangeCapacity);
+        if (segment.memory == MAP_FAILED)
+        {
+            return false;
+        }
+
+        std::cout.flush();
+        const pid_t coordinator = getpid();
+        std::vector<pid_t> workers;
+        for (unsigned i = 0; i < workerOptions.workers; i++)
+        {
+            pid_t pid = fork();
+            if (pid == 0)
+            {
+                int code = 1;
+                try
+                {
+                    code = runWorker(i, corpusPath, workerOptions, byteIds, segment, coordinator);
+                }
+                catch (...)
+                {
+                }
+                std::cout.flush();
+                _exit(code);
+            }
+            if (pid < 0)
+            {
+                break;
+            }
+            workers.push_back(pid);
+        }
+
+        Control &control = *segment.control;
+        bool failed = workers.size() != workerOptions.workers;
+        auto alive = [&workers]
+        {
+            for (const auto &pid : workers)
+            {
+                int status;
+                if (waitpid(pid, &status, WNOHANG) != 0)
+                {
+                    return false;
+                }
+            }
+            return true;
+        };
+
+        auto start = std::chrono::steady_clock::now();
+        std::unordered_map<uint32_t, int64_t> pairCounts;
+        size_t nextTarget = 0;
+        while (!failed)
+        {
+            bool allDone;
+            do
+            {
+                if (!control.barrier.wait(alive))
+                {
+                    failed = true;
+                    break;
+                }
+                allDone = true;
+                for (unsigned worker = 0; worker < workerOptions.workers; worker++)
+                {
+                    const PairDelta *entries = segment.entries + worker * workerOptions.exchangeCapacity;
+                    for (uint64_t i = 0; i < segment.slots[worker].count; i++)
+                    {
+                        auto count = pairCounts.find(entries[i].pair);
+                        if (count == pairCounts.end())
+                        {
+                            pairCounts.emplace(entries[i].pair, entries[i].delta);
+                        }
+                        else if ((count->second += entries[i].delta) == 0)
+                        {
+                            pairCounts.erase(count);
+                        }
+                    }
+                    stats.exchangedDeltas += segment.slots[worker].count;
+                    allDone = allDone && segment.slots[worker].done;
+                }
+                stats.exchangeRounds++;
+                control.allDone = allDone;
+                if (!control.barrier.wait(alive))
+                {
+                    failed = true;
+                    break;
+                }
+            } while (!allDone);
+            if (failed)
+            {
+                break;
+            }
+
+            if (stats.merges == 0)
+            {
+                stats.ingestSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+                start = std::chrono::steady_clock::now();
+                for (unsigned worker = 0; worker < workerOptions.workers; worker++)
+                {
+                    stats.words += segment.slots[worker].words;
+                }
+            }
+            while (nextTarget < targets.size() && tokenizer.getVocabularySize() >= targets[nextTarget])
+            {
+                onVocabularySize(targets[nextTarget++]);
+            }
+
+            uint32_t bestPair = 0;
+            int64_t bestCount = 0;
+            for (const auto &[pair, count] : pairCounts)
+            {
+                if (count > bestCount || (count == bestCount && pair < bestPair))
+                {
+                    bestPair = pair;
+                    bestCount = count;
+                }
+            }
+
+            control.command = nextTarget == targets.size() || bestCount <= 0 ? Command::Stop : Command::Merge;
+            if (control.command == Command::Merge)
+            {
+                control.left = bestPair >> 16;
+                control.right = bestPair & 0xFFFF;
+                control.merged = tokenizer.addMerge({std::string(tokenizer.tokenBytes(control.left)), std::string(tokenizer.tokenBytes(control.right))});
+                stats.merges++;
+            }
+            if (!control.barrier.wait(alive))
+            {
+                failed = true;
+                break;
+            }
+            if (control.command == Command::Stop)
+            {
+                stats.unreachedSizes.assign(targets.begin() + nextTarget, targets.end());
+                break;
+            }
+        }
+        stats.trainSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+        if (failed)
+        {
+            control.aborted.store(1);
+            for (const auto &pid : workers)
+            {
+                kill(pid, SIGKILL);
+            }
+        }
+        for (const auto &pid : workers)
+        {
+            int status = 0;
+            if (waitpid(pid, &status, 0) == pid && (!WIFEXITED(status) || WEXITSTATUS(status) != 0))
+            {
+                failed = true;
+            }
+        }
+        return !failed;
+    }
+}
@@ -0,0 +1,140 @@
+#include <numa_topology.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sstream>
+#ifdef DOKUSHA_WITH_NUMA
+#include <numa.h>
+#endif
+
+namespace dokusha
+{
+    namespace
+    {
+        std::vector<int> allowedCpus()
+        {
+            std::vector<int> cpus;
+            cpu_set_t mask;
+            CPU_ZERO(&mask);
+            if (sched_getaffinity(0, sizeof(mask), &mask) == 0)
+            {
+                for (int cpu = 0; cpu < CPU_SETSIZE; cpu++)
+                {
+                    if (CPU_ISSET(cpu, &mask))
+                    {
+                        cpus.push_back(cpu);
+                    }
+                }
+            }
+            if (cpus.empty())
+            {
+                cpus.push_back(0);
+            }
+            return cpus;
+        }
+    }
+
+    const NumaTopology &NumaTopology::system()
+    {
+        static const NumaTopology topology = []
+        {
+            NumaTopology detected;
+            std::vector<int> cpus = allowedCpus();
+#ifdef DOKUSHA_WITH_NUMA
+            if (numa_available() >= 0)
+            {
+                for (int node = 0; node <= numa_max_node(); node++)
+                {
+                    NumaNode numaNode{node, {}};
+                    for (int cpu : cpus)
+                    {
+                        if (numa_node_of_cpu(cpu) == node)
+                        {
+                            numaNode.cpus.push_back(cpu);
+                        }
+                    }
+                    if (!numaNode.cpus.empty())
+                    {
+                        detected.nodeList.push_back(std::move(numaNode));
+                    }
+                }
+            }
+            if (!detected.nodeList.empty())
+            {
+                detected.origin = "libnuma";
+                return detected;
+            }
+#endif
+            detected.nodeList.push_back(NumaNode{0, std::move(cpus)});
+            detected.origin = "affinity";
+            return detected;
+        }();
+        return topology;
+    }
+
+    std::vector<ThreadPlacement> NumaTopology::place(int numThreads) const
+    {
+        std::vector<std::pair<int, int>> cpus; // Node index and CPU, in node order
+        for (size_t node = 0; node < this->nodeList.size(); node++)
+        {
+            for (int cpu : this->nodeList[node].cpus)
+            {
+                cpus.emplace_back(node, cpu);
+            }
+        }
+
+        std::vector<ThreadPlacement> placements;
+        std::vector<bool> nodeHasLeader(this->nodeList.size(), false);
+        for (int thread = 0; thread < numThreads; thread++)
+        {
+            const auto &[node, cpu] = cpus[static_cast<size_t>(thread) * cpus.size() / numThreads];
+            placements.push_back(ThreadPlacement{node, cpu, !nodeHasLeader[node]});
+            nodeHasLeader[node] = true;
+        }
+        return placements;
+    }
+
+    std::string NumaTopology::toJson(const std::vector<ThreadPlacement> &placements) const
+    {
+        std::ostringstream json;
+        json << "{\"source\":\"" << this->origin << "\",\"nodes\":[";
+        for (size_t node = 0; node < this->nodeList.size(); node++)
+        {
+            json << (node > 0 ? "," : "") << "{\"id\":" << this->nodeList[node].id << ",\"cpus\":[";
+            for (size_t i = 0; i < this->nodeList[node].cpus.size(); i++)
+            {
+                json << (i > 0 ? "," : "") << this->nodeList[node].cpus[i];
+            }
+            json << "]}";
+        }
+        json << "],\"threads\":[";
+        for (size_t thread = 0; thread < placements.size(); thread++)
+        {
+            json << (thread > 0 ? "," : "") << "{\"node\":" << this->nodeList[placements[thread].node].id << ",\"cpu\":" << placements[thread].cpu
+                 << ",\"node_leader\":" << (placements[thread].nodeLeader ? "true" : "false") << "}";
+        }
+        json << "]}";
+        return json.str();
+    }
+
+    bool pinCurrentThread(int cpu)
+    {
+        cpu_set_t mask;
+        CPU_ZERO(&mask);
+        CPU_SET(cpu, &mask);
+        return pthread_setaffinity_np(pthread_self(), sizeof(mask), &mask) == 0;
+    }
+
+    ScopedAffinity::ScopedAffinity()
+    {
+        CPU_ZERO(&this->saved);
+        this->valid = pthread_getaffinity_np(pthread_self(), sizeof(this->saved), &this->saved) == 0;
+    }
+
+    ScopedAffinity::~ScopedAffinity()
+    {
+        if (this->valid)
+        {
+            pthread_setaffinity_np(pthread_self(), sizeof(this->saved), &this->saved);
+        }
+    }
+}
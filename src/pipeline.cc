@@ -0,0 +1,371 @@
+#include <pipeline.h>
+#include <decompress.h>
+#include <chrono>
+#include <cstdio>
+#include <filesystem>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string_view>
+#include <thread>
+
+namespace dokusha
+{
+    namespace
+    {
+        template <typename U>
+        void writeLittleEndian(std::ofstream &outFile, U value)
+        {
+            unsigned char bytes[sizeof(U)];
+            for (size_t i = 0; i < sizeof(U); i++)
+            {
+                bytes[i] = static_cast<unsigned char>(value >> (8 * i));
+            }
+            outFile.write(reinterpret_cast<const char *>(bytes), sizeof(U));
+        }
+
+        class ShardWriter
+        {
+        private:
+            std::string outputDirectory;
+            unsigned tokenWidth;
+            uint64_t shardTokens;
+            unsigned shardIndex;
+            std::ofstream tokenFile;
+            std::vector<uint64_t> documentOffsets;
+            std::vector<char> buffer;
+
+            std::string shardPath(const char *extension) const
+            {
+                char name[32];
+                std::snprintf(name, sizeof(name), "shard_%05u.%s", this->shardIndex, extension);
+                return (std::filesystem::path(this->outputDirectory) / name).string();
+            }
+
+            void open()
+            {
+                this->tokenFile.open(this->shardPath("bin"), std::ios::binary);
+                if (!this->tokenFile)
+                {
+                    throw std::runtime_error("Unable to open " + this->shardPath("bin"));
+                }
+                this->documentOffsets.assign(1, 0);
+            }
+
+            template <typename U>
+            void writeTokens(const unsigned short *tokens, size_t count)
+            {
+                this->buffer.resize(count * sizeof(U));
+                char *out = this->buffer.data();
+                for (size_t i = 0; i < count; i++)
+                {
+                    U value = tokens[i];
+                    for (size_t j = 0; j < sizeof(U); j++)
+                    {
+                        out[i * sizeof(U) + j] = static_cast<char>(value >> (8 * j));
+                    }
+                }
+                if (!this->tokenFile.write(this->buffer.data(), this->buffer.size()))
+                {
+                    throw std::runtime_error("Unable to write " + this->shardPath("bin"));
+                }
+            }
+
+        public:
+            unsigned shardsWritten = 0;
+
+            ShardWriter(const std::string &outputDirectory, unsigned tokenWidth, uint64_t shardTokens)
+                : outputDirectory(outputDirectory), tokenWidth(tokenWidth), shardTokens(shardTokens), shardIndex(0) {}
+
+            void writeDocument(const unsigned short *tokens, uint64_t count)
+            {
+                if (!this->tokenFile.is_open())
+                {
+                    this->open();
+                }
+
+                if (this->tokenWidth == 2)
+                {
+                    this->writeTokens<uint16_t>(tokens, count);
+                }
+                else
+                {
+                    this->writeTokens<uint32_t>(tokens, count);
+                }
+                this->documentOffsets.push_back(this->documentOffsets.back() + count);
+
+                if (this->documentOffsets.back() >= this->shardTokens)
+                {
+                    this->close();
+                }
+            }
+
+            void close()
+            {
+                if (!this->tokenFile.is_open())
+                {
+                    return;
+                }
+                this->tokenFile.close();
+                if (!this->tokenFile)
+                {
+                    throw std::runtime_error("Unable to write " + this->shardPath("bin"));
+                }
+
+                std::ofstream indexFile(this->shardPath("idx"), std::ios::binary);
+                writeLittleEndian<uint32_t>(indexFile, this->tokenWidth);
+                writeLittleEndian<uint64_t>(indexFile, this->documentOffsets.size() - 1);
+                for (const auto &offset : this->documentOffsets)
+                {
+                    writeLittleEndian<uint64_t>(indexFile, offset);
+                }
+                indexFile.close();
+                if (!indexFile)
+                {
+                    throw std::runtime_error("Unable to write " + this->shardPath("idx"));
+                }
+
+                this->shardIndex++;
+                this->shardsWritten++;
+            }
+        };
+    }
+
+    EncodePipeline::EncodePipeline(const BPETokenizer<std::string> &tokenizer, EncodePipelineOptions options)
+        : tokenizer(tokenizer), options(std::move(options))
+    {
+        if (this->options.tokenWidth != 2 && this->options.tokenWidth != 4)
+        {
+            throw std::invalid_argument("Token width must be 2 or 4 bytes");
+        }
+        this->options.splitterThreads = std::max(1u, this->options.splitterThreads);
+        this->options.encoderThreads = std::max(1u, this->options.encoderThreads);
+    }
+
+    void EncodePipeline::readStage(const std::vector<std::string> &inputFiles, BoundedQueue<TextBlock> &output, EncodePipelineStats &stats)
+    {
+        size_t sequence = 0;
+        std::string carry;
+        std::string decompressed;
+
+        for (const auto &inputFile : inputFiles)
+        {
+            // Compressed files are inflated on the decompressor's own thread, plain files are read directly
+            std::unique_ptr<DecompressingReader> decompressor;
+            std::ifstream inFile;
+            if (detectCompression(inputFile) != Compression::None)
+            {
+                decompressor = std::make_unique<DecompressingReader>(inputFile, this->options.blockSize);
+            }
+            else
+            {
+                inFile.open(inputFile, std::ios::binary);
+                if (!inFile)
+                {
+                    throw std::runtime_error("Unable to open " + inputFile);
+                }
+            }
+            carry.clear();
+
+            bool moreInput = true;
+            while (moreInput)
+            {
+                std::string block = std::move(carry);
+                size_t carrySize = block.size();
+                if (decompressor)
+                {
+                    moreInput = decompressor->readBlock(decompressed);
+                    if (moreInput)
+                    {
+                        block.append(decompressed);
+                    }
+                }
+                else
+                {
+                    block.resize(carrySize + this->options.blockSize);
+                    inFile.read(&block[carrySize], this->options.blockSize);
+                    block.resize(carrySize + inFile.gcount());
+                    moreInput = static_cast<bool>(inFile);
+                }
+                stats.bytesRead += block.size() - carrySize;
+
+                // Keep the trailing partial line for the next block, so documents never straddle blocks
+                if (moreInput)
+                {
+                    size_t lastNewline = block.rfind('\n');
+                    if (lastNewline == std::string::npos)
+                    {
+                        carry = std::move(block);
+                        continue;
+                    }
+                    carry.assign(block, lastNewline + 1);
+                    block.resize(lastNewline + 1);
+                }
+
+                // A closed queue means a later stage failed
+                if (!block.empty() && !output.push(TextBlock{sequence++, std::move(block)}))
+                {
+                    return;
+                }
+            }
+        }
+    }
+
+    void EncodePipeline::splitLinesStage(BoundedQueue<TextBlock> &input, BoundedQueue<LineBlock> &output)
+    {
+        while (auto block = input.pop())
+        {
+            LineBlock lineBlock{block->sequence, std::move(block->text), {}};
+            size_t begin = 0;
+
+            // Empty lines stay documents of their own, so the index has one entry per input line
+            while (begin < lineBlock.text.size())
+            {
+                size_t end = lineBlock.text.find('\n', begin);
+                if (end == std::string::npos)
+                {
+                    end = lineBlock.text.size();
+                }
+                lineBlock.lineEnds.push_back(end);
+                begin = end + 1;
+            }
+            if (!output.push(std::move(lineBlock)))
+            {
+                return;
+            }
+        }
+    }
+
+    void EncodePipeline::encodeStage(BoundedQueue<LineBlock> &input, BoundedQueue<TokenBlock> &output)
+    {
+        while (auto block = input.pop())
+        {
+            TokenBlock tokenBlock{block->sequence, {}, {}};
+            tokenBlock.documentLengths.reserve(block->lineEnds.size());
+
+            std::string_view text = block->text;
+            size_t begin = 0;
+            for (const auto &end : block->lineEnds)
+            {
+                // Appends the same tokens as tokenize(line), special tokens being cut out before words are split
+                size_t before = tokenBlock.tokens.size();
+                this->tokenizer.encodeSpan(trimmedView(text.substr(begin, end - begin)), tokenBlock.tokens);
+                tokenBlock.documentLengths.push_back(tokenBlock.tokens.size() - before);
+                begin = end + 1;
+            }
+            if (!output.push(std::move(tokenBlock)))
+            {
+                return;
+            }
+        }
+    }
+
+    void EncodePipeline::writeStage(BoundedQueue<TokenBlock> &input, EncodePipelineStats &stats)
+    {
+        ShardWriter writer(this->options.outputDirectory, this->options.tokenWidth, this->options.shardTokens);
+        std::map<size_t, TokenBlock> pending;
+        size_t nextSequence = 0;
+
+        while (auto block = input.pop())
+        {
+            pending.emplace(block->sequence, std::move(*block));
+
+            // Encoders finish out of order; only write once the next block in input order has arrived
+            for (auto it = pending.begin(); it != pending.end() && it->first == nextSequence; it = pending.erase(it))
+            {
+                const unsigned short *tokens = it->second.tokens.data();
+                for (const auto &length : it->second.documentLengths)
+                {
+                    writer.writeDocument(tokens, length);
+                    tokens += length;
+                }
+                stats.documents += it->second.documentLengths.size();
+                stats.tokens += it->second.tokens.size();
+                nextSequence++;
+            }
+        }
+
+        writer.close();
+        stats.shards = writer.shardsWritten;
+    }
+
+    EncodePipelineStats EncodePipeline::run(const std::vector<std::string> &inputFiles)
+    {
+        EncodePipelineStats stats;
+        auto start = std::chrono::steady_clock::now();
+
+        std::filesystem::create_directories(this->options.outputDirectory);
+
+        BoundedQueue<TextBlock> textQueue(this->options.queueCapacity);
+        BoundedQueue<LineBlock> lineQueue(this->options.queueCapacity);
+        BoundedQueue<TokenBlock> tokenQueue(this->options.queueCapacity);
+
+        // The first error of any stage closes every queue, which makes all stages stop, and is rethrown once
+        // they have
+        std::mutex failureMutex;
+        std::exception_ptr failure;
+        auto guarded = [&](auto stage)
+        {
+            return [&, stage]
+            {
+                try
+                {
+                    stage();
+                }
+                catch (...)
+                {
+                    {
+                        std::lock_guard<std::mutex> lock(failureMutex);
+                        if (!failure)
+                        {
+                            failure = std::current_exception();
+                        }
+                    }
+                    textQueue.close();
+                    lineQueue.close();
+                    tokenQueue.close();
+                }
+            };
+        };
+
+        std::thread reader(guarded([&] { this->readStage(inputFiles, textQueue, stats); }));
+
+        std::vector<std::thread> splitters;
+        for (unsigned i = 0; i < this->options.splitterThreads; i++)
+        {
+            splitters.emplace_back(guarded([&] { this->splitLinesStage(textQueue, lineQueue); }));
+        }
+
+        std::vector<std::thread> encoders;
+        for (unsigned i = 0; i < this->options.encoderThreads; i++)
+        {
+            encoders.emplace_back(guarded([&] { this->encodeStage(lineQueue, tokenQueue); }));
+        }
+
+        std::thread writer(guarded([&] { this->writeStage(tokenQueue, stats); }));
+
+        // Each queue is closed once every producer feeding it is done, which lets the next stage drain and exit
+        reader.join();
+        textQueue.close();
+        for (auto &thread : splitters)
+        {
+            thread.join();
+        }
+        lineQueue.close();
+        for (auto &thread : encoders)
+        {
+            thread.join();
+        }
+        tokenQueue.close();
+        writer.join();
+        if (failure)
+        {
+            std::rethrow_exception(failure);
+        }
+
+        auto end = std::chrono::steady_clock::now();
+        stats.seconds = std::chrono::duration<double>(end - start).count();
+        return stats;
+    }
+}
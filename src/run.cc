@@ -1,84 +1,151 @@
 #include <bpe.h>
+#include <ingest.h>
+#include <multiprocess_training.h>
+#include <stats.h>
+#include <algorithm>
 #include <cassert>
-#include <fstream>
 #include <chrono>
-#include <filesystem>
+#include <sstream>
 
-using recursive_directory_iterator = std::filesystem::recursive_directory_iterator;
+// Number of most frequent training words whose encodings are precomputed in the saved tokenizer
+static constexpr size_t frequentWordTableSize = 10000;
 
+static void saveSnapshot(dokusha::BPETokenizer<std::string> &tokenizer, unsigned short vocabularySize)
+{
+    tokenizer.compileMergeTable();
+    std::string snapshotPath = "tokenizer_state_" + std::to_string(vocabularySize) + ".bin";
+    tokenizer.save(snapshotPath, frequentWordTableSize);
+    std::cout << std::endl << "Saved " << snapshotPath << std::endl;
+}
+
+// Usage: run <corpus directory> [vocabulary sizes, comma separated, default 1024] [--processes N] [--numa]
+//                                    [--huge-pages off|thp|hugetlb] [--memory-every N]
+//
+// Merges are learned in order, so the tokenizer at a smaller vocabulary size is exactly the training state on
+// the way to a larger one. One run trains to the largest size and snapshots tokenizer_state_<size>.bin as it
+// passes each of the others; the largest is also saved as tokenizer_state.bin.
+//
+// --processes N splits the word table over N worker processes (see trainMultiProcess), for corpora whose
+// words do not fit in one address space or whose training is bound by a single process. --numa trains on
+// all OpenMP threads with the word table partitioned per NUMA node (see BPETokenizer::setNumaTraining).
+// --huge-pages backs the word table and pair counts with huge pages (see hugepages::setMode).
+// --memory-every N also estimates the memory usage after every Nth merge for the peak in memory_usage.json,
+// which otherwise only covers the start and the end of training; each estimate costs about one pair count.
 int main(int argc, char **argv)
 {
+    std::vector<std::string> arguments;
+    unsigned processes = 0;
+    bool numaTraining = false;
+    unsigned memorySampleInterval = 0;
+    for (int i = 1; i < argc; i++)
+    {
+        if (std::string(argv[i]) == "--processes" && i + 1 < argc)
+        {
+            processes = std::stoul(argv[++i]);
+        }
+        else if (std::string(argv[i]) == "--huge-pages" && i + 1 < argc)
+        {
+            dokusha::hugepages::setMode(dokusha::hugepages::parseMode(argv[++i], dokusha::HugePageMode::Off));
+        }
+        else if (std::string(argv[i]) == "--memory-every" && i + 1 < argc)
+        {
+            memorySampleInterval = std::stoul(argv[++i]);
+        }
+        else if (std::string(argv[i]) == "--numa")
+        {
+            numaTraining = true;
+        }
+        else
+        {
+            arguments.push_back(argv[i]);
+        }
+    }
+    assert(arguments.size() == 1 || arguments.size() == 2);
+    std::vector<unsigned short> vocabularySizes;
+    std::istringstream sizeList(arguments.size() == 2 ? arguments[1] : "1024");
+    for (std::string size; std::getline(sizeList, size, ',');)
+    {
+        vocabularySizes.push_back(std::stoul(size));
+    }
+    std::sort(vocabularySizes.begin(), vocabularySizes.end());
+    vocabularySizes.erase(std::unique(vocabularySizes.begin(), vocabularySizes.end()), vocabularySizes.end());
+    assert(!vocabularySizes.empty());
 
-    assert(argc == 2);
     dokusha::BPETokenizer<std::string> tokenizer;
-    std::ifstream fio;
-    std::string line;
     std::chrono::time_point<std::chrono::steady_clock> start, end;
-    std::string buffer;
+    dokusha::MemoryPeak memoryPeak;
+    int status = 0;
 
-    int filesCompleted = 0;
-    for (const auto &textFile : recursive_directory_iterator(argv[1]))
+    if (processes > 0)
     {
-        start = std::chrono::steady_clock::now();
-        fio.open(textFile.path(), std::ios::binary);
-        fio.seekg(0, std::ios::end);
-        std::streampos fileSize = fio.tellg();
-        fio.seekg(0, std::ios::beg);
-
-        // Define a string to hold the binary data with appropriate size
-        buffer.clear();
-        buffer.resize(static_cast<size_t>(fileSize));
-        // Read the binary data into the string buffer
-        fio.read(&buffer[0], fileSize);
-        std::stringstream ss(buffer);
-
-        int lineIndex = 0;
-
-        while (getline(ss, line))
+        // Runs before any OpenMP region of this process, which libgomp requires of fork()
+        dokusha::MultiProcessTrainingOptions options;
+        options.workers = processes;
+        dokusha::MultiProcessTrainingStats trainingStats;
+        if (!dokusha::trainMultiProcess(arguments[0], tokenizer, vocabularySizes, options,
+                                        [&tokenizer](unsigned short vocabularySize) { saveSnapshot(tokenizer, vocabularySize); }, trainingStats))
         {
-
-            lineIndex++;
-            if (lineIndex < 3)
+            std::cerr << "Multi-process training failed" << std::endl;
+            return 1;
+        }
+        std::cout << "Workers: " << trainingStats.workers << ", words: " << trainingStats.words << ", merges: " << trainingStats.merges
+                  << ", exchanged deltas: " << trainingStats.exchangedDeltas << " in " << trainingStats.exchangeRounds << " rounds" << std::endl;
+        std::cout << "Ingestion Time(s): " << trainingStats.ingestSeconds << ", Training Time(s): " << trainingStats.trainSeconds << std::endl;
+        if (!trainingStats.unreachedSizes.empty())
+        {
+            std::cerr << "No pair left to merge at vocabulary size " << tokenizer.getVocabularySize() << ", not saved:";
+            for (unsigned short vocabularySize : trainingStats.unreachedSizes)
             {
-                continue;
+                std::cerr << " tokenizer_state_" << vocabularySize << ".bin";
             }
-            tokenizer.addToCorpus(line);
+            std::cerr << std::endl;
+            status = 1;
         }
-
-        // Close the file after reading
-        fio.close();
-        filesCompleted++;
-
-        fio.close();
-
-        end = std::chrono::steady_clock::now();
-        std::cout << "\r[Files completed: " << filesCompleted << "], Time(ms):"
-                  << std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count() << ", Vocabulary Size: " << tokenizer.getVocabularySize() << " |";
-        std::cout.flush();
-        // if (filesCompleted % 100 == 0)
-        // {
-        // break;
-        // tokenizer.pruneWordList();
-        // }
-        // break;
     }
-
-    tokenizer.pruneWordList();
-
-    while (tokenizer.getVocabularySize() < 1024)
+    else
     {
         start = std::chrono::steady_clock::now();
-        tokenizer.runLearningIteration();
+        std::vector<dokusha::IngestWorkerStats> ingestStats = dokusha::ingestCorpus(arguments[0], tokenizer);
         end = std::chrono::steady_clock::now();
-        std::cout << "\r[Vocab Size: " << tokenizer.getVocabularySize() << "], Time(s):"
-                  << std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count() / 1000.0 << " |";
-        std::cout.flush();
+        dokusha::printIngestStats(ingestStats);
+        if (dokusha::ingestFailed(ingestStats))
+        {
+            std::cerr << "Some corpus files could not be read" << std::endl;
+            return 1;
+        }
+        std::cout << "Ingestion Time(ms): " << std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count() << std::endl;
+
+        tokenizer.pruneWordList();
+        tokenizer.setNumaTraining(numaTraining);
+        memoryPeak.update(tokenizer.memoryUsage());
+
+        for (unsigned short vocabularySize : vocabularySizes)
+        {
+            while (tokenizer.getVocabularySize() < vocabularySize)
+            {
+                start = std::chrono::steady_clock::now();
+                tokenizer.runLearningIteration();
+                end = std::chrono::steady_clock::now();
+                if (memorySampleInterval > 0 && tokenizer.getMergeRuleCount() % memorySampleInterval == 0)
+                {
+                    memoryPeak.update(tokenizer.memoryUsage());
+                }
+                std::cout << "\r[Vocab Size: " << tokenizer.getVocabularySize() << "], Time(s):"
+                          << std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count() / 1000.0 << " |";
+                std::cout.flush();
+            }
+            saveSnapshot(tokenizer, vocabularySize);
+        }
     }
-    std::cout << std::endl;
 
     // tokenizer.pruneRedundantTokens();
     tokenizer.printVocabulary(false);
-    tokenizer.save("tokenizer_state.bin");
+    tokenizer.save("tokenizer_state.bin", frequentWordTableSize);
+    dokusha::stats::setSection("huge_pages", dokusha::hugepages::toJson());
+    std::ofstream("training_stats.json") << dokusha::stats::toJson() << std::endl;
+    dokusha::MemoryUsage finalUsage = tokenizer.memoryUsage();
+    memoryPeak.update(finalUsage);
+    std::ofstream("memory_usage.json") << "{\"final\":" << finalUsage.toJson() << ",\"peak\":" << memoryPeak.toJson() << "}" << std::endl;
     // tokenizer.printMergeRules();
 
     // Example test
@@ -88,5 +155,5 @@ int main(int argc, char **argv)
     std::string s = "abcd";
     assert(tokenizer.detokenize(tokenizer.tokenize(s)) == s);
 
-    return 0;
+    return status;
 }
\ No newline at end of file
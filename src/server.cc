@@ -0,0 +1,337 @@
+#include <server.h>
+#include <stats.h>
+#include <bit>
+#include <cerrno>
+#include <cstring>
+#include <sstream>
+#include <stdexcept>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+namespace dokusha
+{
+    namespace
+    {
+        bool readFully(int fd, void *data, size_t size)
+        {
+            char *buffer = static_cast<char *>(data);
+            while (size > 0)
+            {
+                ssize_t received = recv(fd, buffer, size, 0);
+                if (received < 0 && errno == EINTR)
+                {
+                    continue;
+                }
+                if (received <= 0)
+                {
+                    return false;
+                }
+                buffer += received;
+                size -= received;
+            }
+            return true;
+        }
+
+        bool writeFully(int fd, const void *data, size_t size)
+        {
+            const char *buffer = static_cast<const char *>(data);
+            while (size > 0)
+            {
+                ssize_t sent = send(fd, buffer, size, MSG_NOSIGNAL);
+                if (sent < 0 && errno == EINTR)
+                {
+                    continue;
+                }
+                if (sent <= 0)
+                {
+                    return false;
+                }
+                buffer += sent;
+                size -= sent;
+            }
+            return true;
+        }
+
+        bool writeResponse(int fd, const void *payload, uint32_t size)
+        {
+            return writeFully(fd, &size, sizeof(size)) && writeFully(fd, payload, size);
+        }
+    }
+
+    void Histogram::record(uint64_t value)
+    {
+        size_t bucket = std::min<size_t>(std::bit_width(value), this->buckets.size() - 1);
+        this->buckets[bucket].fetch_add(1, std::memory_order_relaxed);
+    }
+
+    std::string Histogram::toJson() const
+    {
+        size_t used = this->buckets.size();
+        while (used > 0 && this->buckets[used - 1].load(std::memory_order_relaxed) == 0)
+        {
+            used--;
+        }
+
+        std::string json = "[";
+        for (size_t i = 0; i < used; i++)
+        {
+            json += (i > 0 ? "," : "") + std::to_string(this->buckets[i].load(std::memory_order_relaxed));
+        }
+        return json + "]";
+    }
+
+    TokenizerServer::TokenizerServer(const TokenizerHandle &tokenizers, const ServerOptions &options)
+        : tokenizers(tokenizers), options(options), requests(options.queueCapacity)
+    {
+    }
+
+    TokenizerServer::~TokenizerServer()
+    {
+        this->stop();
+    }
+
+    void TokenizerServer::run()
+    {
+        if (this->options.socketPath.size() >= sizeof(sockaddr_un::sun_path))
+        {
+            throw std::runtime_error("Socket path too long: " + this->options.socketPath);
+        }
+        int listenFd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (listenFd < 0)
+        {
+            throw std::runtime_error(std::string("Cannot create socket: ") + std::strerror(errno));
+        }
+
+        sockaddr_un address{};
+        address.sun_family = AF_UNIX;
+        std::strcpy(address.sun_path, this->options.socketPath.c_str());
+        unlink(this->options.socketPath.c_str());
+        if (bind(listenFd, reinterpret_cast<sockaddr *>(&address), sizeof(address)) < 0 || listen(listenFd, SOMAXCONN) < 0)
+        {
+            int error = errno;
+            close(listenFd);
+            throw std::runtime_error("Cannot listen on " + this->options.socketPath + ": " + std::strerror(error));
+        }
+        // Published only once listening, so that stop() never shuts down a socket that is not set up yet. A stop()
+        // before this point has already set stopping, and the loop below does not start.
+        this->listenFd.store(listenFd);
+
+        std::vector<std::thread> encoders;
+        for (unsigned i = 0; i < std::max(1u, this->options.encoderThreads); i++)
+        {
+            encoders.emplace_back(&TokenizerServer::encodeLoop, this);
+        }
+
+        while (!this->stopping.load())
+        {
+            int fd = accept(listenFd, nullptr, nullptr);
+            if (fd < 0)
+            {
+                if (errno == EINTR || errno == ECONNABORTED)
+                {
+                    continue;
+                }
+                break;
+            }
+
+            this->joinFinishedConnections();
+            std::lock_guard<std::mutex> lock(this->connectionsMutex);
+            uint64_t connection = this->connections++;
+            this->connectionFds.push_back(fd);
+            this->connectionThreads.emplace(connection, std::thread(&TokenizerServer::serveConnection, this, fd, connection));
+        }
+
+        // Queued requests are still answered before the encoders exit
+        this->requests.close();
+        for (auto &encoder : encoders)
+        {
+            encoder.join();
+        }
+
+        std::unordered_map<uint64_t, std::thread> connectionThreads;
+        {
+            std::lock_guard<std::mutex> lock(this->connectionsMutex);
+            for (const auto &fd : this->connectionFds)
+            {
+                shutdown(fd, SHUT_RDWR);
+            }
+            connectionThreads.swap(this->connectionThreads);
+            this->finishedConnections.clear();
+        }
+        for (auto &[connection, connectionThread] : connectionThreads)
+        {
+            connectionThread.join();
+        }
+
+        this->listenFd.store(-1);
+        close(listenFd);
+        unlink(this->options.socketPath.c_str());
+    }
+
+    void TokenizerServer::stop()
+    {
+        if (!this->stopping.exchange(true))
+        {
+            int listenFd = this->listenFd.load();
+            if (listenFd >= 0)
+            {
+                // Wakes up the blocking accept() in run()
+                shutdown(listenFd, SHUT_RDWR);
+            }
+        }
+    }
+
+    void TokenizerServer::joinFinishedConnections()
+    {
+        std::vector<std::thread> finished;
+        {
+            std::lock_guard<std::mutex> lock(this->connectionsMutex);
+            for (const auto &connection : this->finishedConnections)
+            {
+                auto found = this->connectionThreads.find(connection);
+                finished.push_back(std::move(found->second));
+                this->connectionThreads.erase(found);
+            }
+            this->finishedConnections.clear();
+        }
+        // The threads have left serveConnection() or are about to, so these joins return at once
+        for (auto &thread : finished)
+        {
+            thread.join();
+        }
+    }
+
+    void TokenizerServer::encodeLoop()
+    {
+        std::vector<EncodeRequest> batch;
+        std::vector<std::string> texts;
+        while (auto first = this->requests.pop())
+        {
+            batch.clear();
+            batch.push_back(std::move(*first));
+            auto deadline = std::chrono::steady_clock::now() + this->options.batchDelay;
+            while (batch.size() < this->options.maxBatch)
+            {
+                auto next = this->requests.popUntil(deadline);
+                if (!next)
+                {
+                    break;
+                }
+                batch.push_back(std::move(*next));
+            }
+            this->queueDepth.record(this->requests.size());
+            this->batchSize.record(batch.size());
+            this->batches++;
+
+            texts.clear();
+            for (auto &request : batch)
+            {
+                texts.push_back(std::move(request.text));
+            }
+
+            try
+            {
+                std::vector<std::vector<unsigned short>> results = this->tokenizers.get()->tokenizeBatch(texts);
+                auto now = std::chrono::steady_clock::now();
+                for (size_t i = 0; i < batch.size(); i++)
+                {
+                    this->latencyMicros.record(std::chrono::duration_cast<std::chrono::microseconds>(now - batch[i].enqueued).count());
+                    batch[i].result.set_value(std::move(results[i]));
+                }
+            }
+            catch (...)
+            {
+                for (auto &request : batch)
+                {
+                    request.result.set_exception(std::current_exception());
+                }
+            }
+        }
+    }
+
+    void TokenizerServer::serveConnection(int fd, uint64_t connection)
+    {
+        std::string payload;
+        std::string decoded;
+        while (true)
+        {
+            uint8_t op;
+            uint32_t size;
+            if (!readFully(fd, &op, sizeof(op)) || !readFully(fd, &size, sizeof(size)) || size > this->options.maxPayload)
+            {
+                break;
+            }
+            payload.resize(size);
+            if (!readFully(fd, payload.data(), size))
+            {
+                break;
+            }
+
+            bool written = false;
+            if (op == encodeOp)
+            {
+                this->encodeRequests++;
+                EncodeRequest request{std::move(payload), {}, std::chrono::steady_clock::now()};
+                auto result = request.result.get_future();
+                if (!this->requests.push(std::move(request)))
+                {
+                    break;
+                }
+                std::vector<unsigned short> tokens;
+                try
+                {
+                    tokens = result.get();
+                }
+                catch (...)
+                {
+                    break;
+                }
+                written = writeResponse(fd, tokens.data(), tokens.size() * sizeof(unsigned short));
+            }
+            else if (op == decodeOp)
+            {
+                this->decodeRequests++;
+                decoded.clear();
+                TokenizerHandle::Snapshot tokenizer = this->tokenizers.get();
+                const unsigned short *tokens = reinterpret_cast<const unsigned short *>(payload.data());
+                for (size_t i = 0; i < size / sizeof(unsigned short); i++)
+                {
+                    decoded += tokenizer->tokenBytes(tokens[i]);
+                }
+                written = writeResponse(fd, decoded.data(), decoded.size());
+            }
+            else if (op == statsOp)
+            {
+                std::string stats = this->statsJson();
+                written = writeResponse(fd, stats.data(), stats.size());
+            }
+
+            if (!written)
+            {
+                break;
+            }
+        }
+
+        std::lock_guard<std::mutex> lock(this->connectionsMutex);
+        std::erase(this->connectionFds, fd);
+        close(fd);
+        this->finishedConnections.push_back(connection);
+    }
+
+    std::string TokenizerServer::statsJson() const
+    {
+        std::ostringstream json;
+        json << "{\"tokenizer_version\":" << this->tokenizers.version()
+             << ",\"connections\":" << this->connections.load()
+             << ",\"encode_requests\":" << this->encodeRequests.load()
+             << ",\"decode_requests\":" << this->decodeRequests.load()
+             << ",\"batches\":" << this->batches.load()
+             << ",\"queue_depth\":" << this->queueDepth.toJson()
+             << ",\"batch_size\":" << this->batchSize.toJson()
+             << ",\"latency_us\":" << this->latencyMicros.toJson()
+             << ",\"library\":" << stats::toJson()
+             << "}";
+        return json.str();
+    }
+}
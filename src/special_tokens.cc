@@ -0,0 +1,138 @@
+#include <special_tokens.h>
+#include <memory_usage.h>
+#include <algorithm>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+namespace dokusha
+{
+    size_t SpecialTokens::memoryUsage() const
+    {
+        size_t bytes = memory::heapBytes(this->tokensById) + memory::heapBytes(this->idsByToken) + memory::heapBytes(this->firstBytes) +
+                       memory::mallocChunk(this->trie.capacity() * sizeof(TrieNode));
+        for (const auto &node : this->trie)
+        {
+            bytes += memory::heapBytes(node.children);
+        }
+        return bytes;
+    }
+
+    bool SpecialTokens::add(const std::string &token, unsigned short tokenId)
+    {
+        if (token.empty() || token.find_first_of(" \n") != std::string::npos ||
+            this->idsByToken.contains(token) || this->tokensById.contains(tokenId))
+        {
+            return false;
+        }
+        this->idsByToken.emplace(token, tokenId);
+        this->tokensById.emplace(tokenId, token);
+
+        if (this->trie.empty())
+        {
+            this->trie.emplace_back();
+        }
+        uint32_t node = 0;
+        for (const auto &ci : token)
+        {
+            auto &children = this->trie[node].children;
+            auto childIter = std::find_if(children.begin(), children.end(), [ci](const auto &child)
+                                          { return child.first == static_cast<unsigned char>(ci); });
+            if (childIter != children.end())
+            {
+                node = childIter->second;
+                continue;
+            }
+            uint32_t child = this->trie.size();
+            this->trie[node].children.emplace_back(static_cast<unsigned char>(ci), child);
+            this->trie.emplace_back();
+            node = child;
+        }
+        this->trie[node].tokenId = tokenId;
+
+        unsigned char firstByte = static_cast<unsigned char>(token[0]);
+        if (!this->isFirstByte[firstByte])
+        {
+            this->isFirstByte[firstByte] = true;
+            this->firstBytes.push_back(firstByte);
+        }
+        return true;
+    }
+
+    size_t SpecialTokens::nextCandidate(std::string_view text, size_t from) const
+    {
+        size_t position = from;
+#ifdef __SSE2__
+        if (this->firstBytes.size() <= maxVectorFirstBytes)
+        {
+            __m128i needles[maxVectorFirstBytes];
+            for (size_t i = 0; i < this->firstBytes.size(); i++)
+            {
+                needles[i] = _mm_set1_epi8(static_cast<char>(this->firstBytes[i]));
+            }
+            for (; position + 16 <= text.size(); position += 16)
+            {
+                __m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i *>(text.data() + position));
+                __m128i matches = _mm_setzero_si128();
+                for (size_t i = 0; i < this->firstBytes.size(); i++)
+                {
+                    matches = _mm_or_si128(matches, _mm_cmpeq_epi8(block, needles[i]));
+                }
+                int mask = _mm_movemask_epi8(matches);
+                if (mask != 0)
+                {
+                    return position + __builtin_ctz(mask);
+                }
+            }
+        }
+#endif
+        for (; position < text.size(); position++)
+        {
+            if (this->isFirstByte[static_cast<unsigned char>(text[position])])
+            {
+                return position;
+            }
+        }
+        return npos;
+    }
+
+    size_t SpecialTokens::matchAt(std::string_view text, size_t position, unsigned short &tokenId) const
+    {
+        size_t length = 0;
+        uint32_t node = 0;
+        for (size_t i = position; i < text.size(); i++)
+        {
+            const auto &children = this->trie[node].children;
+            auto childIter = std::find_if(children.begin(), children.end(), [&](const auto &child)
+                                          { return child.first == static_cast<unsigned char>(text[i]); });
+            if (childIter == children.end())
+            {
+                break;
+            }
+            node = childIter->second;
+            if (this->trie[node].tokenId >= 0)
+            {
+                length = i + 1 - position;
+                tokenId = this->trie[node].tokenId;
+            }
+        }
+        return length;
+    }
+
+    size_t SpecialTokens::find(std::string_view text, size_t from, size_t &length, unsigned short &tokenId) const
+    {
+        if (this->empty())
+        {
+            return npos;
+        }
+        for (size_t position = this->nextCandidate(text, from); position != npos; position = this->nextCandidate(text, position + 1))
+        {
+            length = this->matchAt(text, position, tokenId);
+            if (length > 0)
+            {
+                return position;
+            }
+        }
+        return npos;
+    }
+}
@@ -0,0 +1,173 @@
+#include <stats.h>
+#include <array>
+#include <atomic>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <vector>
+
+namespace dokusha::stats
+{
+    namespace
+    {
+        constexpr size_t numCounters = static_cast<size_t>(Counter::NumCounters);
+        constexpr size_t numTimers = static_cast<size_t>(Timer::NumTimers);
+
+        constexpr const char *counterNames[numCounters] = {
+            "ingest_bytes", "ingest_lines", "ingest_words", "merges", "words_touched",
+            "encode_calls", "encode_bytes", "encode_tokens", "decode_calls", "decode_tokens", "decode_bytes"};
+        constexpr const char *timerNames[numTimers] = {"pair_count", "best_pair", "merge_application", "pair_reduction"};
+
+        // Only its own thread writes to a block, everyone may read it
+        struct alignas(64) ThreadBlock
+        {
+            std::array<std::atomic<uint64_t>, numCounters> counters{};
+            std::array<std::atomic<uint64_t>, numTimers> timerCalls{};
+            std::array<std::atomic<uint64_t>, numTimers> timerNanoseconds{};
+        };
+
+        // Blocks of running threads. A thread adds its counts to retired and frees its block when it exits, so
+        // the registry does not grow with every thread a long-lived process has ever started.
+        std::mutex registryMutex;
+        std::vector<std::unique_ptr<ThreadBlock>> registry;
+        ThreadBlock retired;
+        std::map<std::string, std::string> sections;
+
+        void addTo(ThreadBlock &total, const ThreadBlock &block)
+        {
+            for (size_t i = 0; i < numCounters; i++)
+            {
+                total.counters[i].fetch_add(block.counters[i].load(std::memory_order_relaxed), std::memory_order_relaxed);
+            }
+            for (size_t i = 0; i < numTimers; i++)
+            {
+                total.timerCalls[i].fetch_add(block.timerCalls[i].load(std::memory_order_relaxed), std::memory_order_relaxed);
+                total.timerNanoseconds[i].fetch_add(block.timerNanoseconds[i].load(std::memory_order_relaxed), std::memory_order_relaxed);
+            }
+        }
+
+        struct ThreadRegistration
+        {
+            ThreadBlock *block;
+
+            ThreadRegistration()
+            {
+                std::lock_guard<std::mutex> lock(registryMutex);
+                registry.push_back(std::make_unique<ThreadBlock>());
+                this->block = registry.back().get();
+            }
+
+            ~ThreadRegistration()
+            {
+                std::lock_guard<std::mutex> lock(registryMutex);
+                addTo(retired, *this->block);
+                std::erase_if(registry, [this](const std::unique_ptr<ThreadBlock> &entry) { return entry.get() == this->block; });
+            }
+        };
+
+        ThreadBlock &threadBlock()
+        {
+            thread_local ThreadRegistration registration;
+            return *registration.block;
+        }
+
+        // Sum of the retired counts and the blocks of the running threads, registryMutex must be held
+        void total(ThreadBlock &sum)
+        {
+            addTo(sum, retired);
+            for (const auto &block : registry)
+            {
+                addTo(sum, *block);
+            }
+        }
+
+        void increment(std::atomic<uint64_t> &value, uint64_t amount)
+        {
+            value.store(value.load(std::memory_order_relaxed) + amount, std::memory_order_relaxed);
+        }
+    }
+
+    void add(Counter counter, uint64_t value)
+    {
+        increment(threadBlock().counters[static_cast<size_t>(counter)], value);
+    }
+
+    void addTime(Timer timer, uint64_t nanoseconds)
+    {
+        ThreadBlock &block = threadBlock();
+        increment(block.timerCalls[static_cast<size_t>(timer)], 1);
+        increment(block.timerNanoseconds[static_cast<size_t>(timer)], nanoseconds);
+    }
+
+    uint64_t get(Counter counter)
+    {
+        std::lock_guard<std::mutex> lock(registryMutex);
+        ThreadBlock sum;
+        total(sum);
+        return sum.counters[static_cast<size_t>(counter)].load(std::memory_order_relaxed);
+    }
+
+    void reset()
+    {
+        std::lock_guard<std::mutex> lock(registryMutex);
+        auto clear = [](ThreadBlock &block)
+        {
+            for (auto &value : block.counters)
+            {
+                value.store(0, std::memory_order_relaxed);
+            }
+            for (size_t i = 0; i < numTimers; i++)
+            {
+                block.timerCalls[i].store(0, std::memory_order_relaxed);
+                block.timerNanoseconds[i].store(0, std::memory_order_relaxed);
+            }
+        };
+        clear(retired);
+        for (auto &block : registry)
+        {
+            clear(*block);
+        }
+    }
+
+    void setSection(const std::string &name, const std::string &json)
+    {
+        std::lock_guard<std::mutex> lock(registryMutex);
+        sections[name] = json;
+    }
+
+    std::string toJson()
+    {
+        ThreadBlock sum;
+        std::map<std::string, std::string> sectionSnapshot;
+        {
+            std::lock_guard<std::mutex> lock(registryMutex);
+            sectionSnapshot = sections;
+            total(sum);
+        }
+
+        std::ostringstream json;
+#ifdef DOKUSHA_STATS
+        json << "{\"enabled\":true,\"counters\":{";
+#else
+        json << "{\"enabled\":false,\"counters\":{";
+#endif
+        for (size_t i = 0; i < numCounters; i++)
+        {
+            json << (i > 0 ? "," : "") << "\"" << counterNames[i] << "\":" << sum.counters[i].load(std::memory_order_relaxed);
+        }
+        json << "},\"timers\":{";
+        for (size_t i = 0; i < numTimers; i++)
+        {
+            json << (i > 0 ? "," : "") << "\"" << timerNames[i] << "\":{\"calls\":" << sum.timerCalls[i].load(std::memory_order_relaxed)
+                 << ",\"seconds\":" << sum.timerNanoseconds[i].load(std::memory_order_relaxed) / 1e9 << "}";
+        }
+        json << "}";
+        for (const auto &[name, value] : sectionSnapshot)
+        {
+            json << ",\"" << name << "\":" << value;
+        }
+        json << "}";
+        return json.str();
+    }
+}
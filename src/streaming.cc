@@ -0,0 +1,97 @@
+#include <streaming.h>
+#include <algorithm>
+
+namespace dokusha
+{
+    void StreamingEncoder::flushWhitespace(std::vector<unsigned short> &output)
+    {
+        for (const auto &ci : this->pendingWhitespace)
+        {
+            if (ci == ' ')
+            {
+                this->tokenizer.encodeSpan(this->word, output);
+                this->word.clear();
+            }
+            this->word += ci;
+        }
+        this->pendingWhitespace.clear();
+    }
+
+    void StreamingEncoder::feed(std::string_view chunk, std::vector<unsigned short> &output)
+    {
+        size_t index = 0;
+        while (index < chunk.size())
+        {
+            if (chunk[index] == ' ' || chunk[index] == '\n')
+            {
+                size_t end = chunk.find_first_not_of(" \n", index);
+                end = end == std::string_view::npos ? chunk.size() : end;
+                if (this->started)
+                {
+                    this->pendingWhitespace.append(chunk.substr(index, end - index));
+                }
+                index = end;
+                continue;
+            }
+
+            this->flushWhitespace(output);
+            this->started = true;
+
+            size_t end = chunk.find_first_of(" \n", index);
+            end = end == std::string_view::npos ? chunk.size() : end;
+            this->word.append(chunk.substr(index, end - index));
+            index = end;
+        }
+    }
+
+    void StreamingEncoder::finish(std::vector<unsigned short> &output)
+    {
+        if (!this->word.empty())
+        {
+            this->tokenizer.encodeSpan(this->word, output);
+        }
+        this->word.clear();
+        this->pendingWhitespace.clear();
+        this->started = false;
+    }
+
+    void StreamingDecoder::discardEmitted()
+    {
+        this->buffer.erase(0, this->emitted);
+        this->emitted = 0;
+    }
+
+    std::string_view StreamingDecoder::push(unsigned short tokenId)
+    {
+        this->discardEmitted();
+        this->buffer.append(this->tokenizer.tokenBytes(tokenId));
+
+        // Find the last lead byte among the final 4 bytes and hold it back if its character is cut off
+        size_t complete = this->buffer.size();
+        for (size_t back = 1; back <= std::min<size_t>(4, this->buffer.size()); back++)
+        {
+            unsigned char byte = this->buffer[this->buffer.size() - back];
+            if ((byte & 0xC0) == 0x80)
+            {
+                continue; // Continuation byte
+            }
+
+            size_t length = (byte & 0xE0) == 0xC0 ? 2 : (byte & 0xF0) == 0xE0 ? 3 : (byte & 0xF8) == 0xF0 ? 4 : 1;
+            if (length > back)
+            {
+                complete = this->buffer.size() - back;
+            }
+            break;
+        }
+
+        this->emitted = complete;
+        return std::string_view(this->buffer).substr(0, complete);
+    }
+
+    std::string_view StreamingDecoder::finish()
+    {
+        this->discardEmitted();
+        this->emitted = this->buffer.size();
+        return this->buffer;
+    }
+}
@@ -0,0 +1,161 @@
+#include <synthetic_corpus.h>
+#include <algorithm>
+#include <cmath>
+#include <filesystem>
+#include <fstream>
+
+namespace dokusha
+{
+    namespace
+    {
+        void appendUtf8(std::string &output, uint32_t codePoint)
+        {
+            if (codePoint < 0x80)
+            {
+                output += static_cast<char>(codePoint);
+            }
+            else if (codePoint < 0x800)
+            {
+                output += static_cast<char>(0xC0 | (codePoint >> 6));
+                output += static_cast<char>(0x80 | (codePoint & 0x3F));
+            }
+            else if (codePoint < 0x10000)
+            {
+                output += static_cast<char>(0xE0 | (codePoint >> 12));
+                output += static_cast<char>(0x80 | ((codePoint >> 6) & 0x3F));
+                output += static_cast<char>(0x80 | (codePoint & 0x3F));
+            }
+            else
+            {
+                output += static_cast<char>(0xF0 | (codePoint >> 18));
+                output += static_cast<char>(0x80 | ((codePoint >> 12) & 0x3F));
+                output += static_cast<char>(0x80 | ((codePoint >> 6) & 0x3F));
+                output += static_cast<char>(0x80 | (codePoint & 0x3F));
+            }
+        }
+
+        struct CodePointRange
+        {
+            uint32_t first;
+            uint32_t last;
+        };
+
+        // Lowercase letters of each script, by the UTF-8 length of their characters
+        constexpr CodePointRange asciiLetters[] = {{'a', 'z'}};
+        constexpr CodePointRange twoByteLetters[] = {{0x00E0, 0x00FF}, {0x03B1, 0x03C9}, {0x0430, 0x044F}};
+        constexpr CodePointRange threeByteLetters[] = {{0x4E00, 0x9FFF}};
+        constexpr CodePointRange fourByteLetters[] = {{0x1F600, 0x1F64F}};
+    }
+
+    SyntheticCorpus::SyntheticCorpus(const SyntheticCorpusOptions &options) : options(options), state(options.seed)
+    {
+        this->vocabulary.reserve(this->options.vocabularySize);
+        this->cumulative.reserve(this->options.vocabularySize);
+        double total = 0;
+        for (size_t rank = 1; rank <= this->options.vocabularySize; rank++)
+        {
+            this->vocabulary.push_back(this->makeWord());
+            total += std::pow(static_cast<double>(rank), -this->options.zipfExponent);
+            this->cumulative.push_back(total);
+        }
+        for (auto &value : this->cumulative)
+        {
+            value /= total;
+        }
+    }
+
+    uint64_t SyntheticCorpus::next()
+    {
+        uint64_t z = (this->state += 0x9E3779B97F4A7C15ull);
+        z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+        z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+        return z ^ (z >> 31);
+    }
+
+    double SyntheticCorpus::uniform()
+    {
+        return (this->next() >> 11) * 0x1.0p-53;
+    }
+
+    size_t SyntheticCorpus::geometric(double mean)
+    {
+        if (mean <= 1)
+        {
+            return 1;
+        }
+        // Trials up to and including the first success, at success probability 1 / mean
+        return 1 + static_cast<size_t>(std::log1p(-this->uniform()) / std::log1p(-1 / mean));
+    }
+
+    std::string SyntheticCorpus::makeWord()
+    {
+        const auto &weights = this->options.scriptWeights;
+        double pick = this->uniform() * (weights[0] + weights[1] + weights[2] + weights[3]);
+        size_t script = 0;
+        while (script < 3 && pick >= weights[script])
+        {
+            pick -= weights[script];
+            script++;
+        }
+
+        const CodePointRange *ranges[] = {asciiLetters, twoByteLetters, threeByteLetters, fourByteLetters};
+        const size_t numRanges[] = {std::size(asciiLetters), std::size(twoByteLetters), std::size(threeByteLetters), std::size(fourByteLetters)};
+        const CodePointRange &range = ranges[script][this->next() % numRanges[script]];
+
+        // CJK words and emoji runs are shorter in characters than alphabetic words
+        double meanLength = script >= 2 ? std::max(1.0, this->options.meanWordLength / (2 * script - 2)) : this->options.meanWordLength;
+        size_t length = std::min(this->geometric(meanLength), std::max<size_t>(1, this->options.maxWordLength));
+
+        std::string word;
+        for (size_t i = 0; i < length; i++)
+        {
+            appendUtf8(word, range.first + this->next() % (range.last - range.first + 1));
+        }
+        return word;
+    }
+
+    void SyntheticCorpus::appendLine(std::string &output)
+    {
+        size_t numWords = this->geometric(static_cast<double>(this->options.meanWordsPerLine));
+        for (size_t i = 0; i < numWords; i++)
+        {
+            if (i > 0)
+            {
+                output += ' ';
+            }
+            size_t rank = std::upper_bound(this->cumulative.begin(), this->cumulative.end(), this->uniform()) - this->cumulative.begin();
+            output += this->vocabulary[std::min(rank, this->vocabulary.size() - 1)];
+        }
+        output += '.';
+    }
+
+    void SyntheticCorpus::writeFile(const std::string &path, uint64_t bytes)
+    {
+        std::ofstream out(path, std::ios::binary);
+        std::string buffer;
+        uint64_t written = 0;
+        while (written < bytes)
+        {
+            buffer.clear();
+            while (buffer.size() < (1 << 20) && written + buffer.size() < bytes)
+            {
+                this->appendLine(buffer);
+                buffer += '\n';
+            }
+            out.write(buffer.data(), buffer.size());
+            written += buffer.size();
+        }
+    }
+
+    std::vector<std::string> SyntheticCorpus::writeFiles(const std::string &directory, uint64_t bytes, size_t numFiles)
+    {
+        std::filesystem::create_directories(directory);
+        std::vector<std::string> paths;
+        for (size_t i = 0; i < std::max<size_t>(1, numFiles); i++)
+        {
+            paths.push_back((std::filesystem::path(directory) / (std::to_string(i) + ".txt")).string());
+            this->writeFile(paths.back(), bytes / std::max<size_t>(1, numFiles));
+        }
+        return paths;
+    }
+}
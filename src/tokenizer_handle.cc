@@ -0,0 +1,78 @@
+#include <tokenizer_handle.h>
+#include <fcntl.h>
+#include <spanstream>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace dokusha
+{
+    namespace
+    {
+        bool fail(std::string *error, const std::string &reason)
+        {
+            if (error != nullptr)
+            {
+                *error = reason;
+            }
+            return false;
+        }
+    }
+
+    bool TokenizerHandle::reload(const std::string &path, std::string *error)
+    {
+        std::lock_guard<std::mutex> lock(this->reloadMutex);
+
+        int fd = open(path.c_str(), O_RDONLY);
+        if (fd < 0)
+        {
+            return fail(error, "Cannot open " + path);
+        }
+        struct stat fileStatus;
+        if (fstat(fd, &fileStatus) < 0 || fileStatus.st_size == 0)
+        {
+            close(fd);
+            return fail(error, "Empty or unreadable tokenizer file " + path);
+        }
+        void *mapping = mmap(nullptr, fileStatus.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        close(fd);
+        if (mapping == MAP_FAILED)
+        {
+            return fail(error, "Cannot map " + path);
+        }
+
+        // The tokenizer copies what it needs, so the mapping only lives for the duration of the load
+        auto tokenizer = std::make_shared<BPETokenizer<std::string>>();
+        std::ispanstream inStream(std::span<char>(static_cast<char *>(mapping), fileStatus.st_size), std::ios::binary);
+        bool loaded = tokenizer->load(inStream);
+        munmap(mapping, fileStatus.st_size);
+        if (!loaded)
+        {
+            return fail(error, "Truncated tokenizer file " + path);
+        }
+
+        // Every byte has to survive a round trip, otherwise the rules or the vocabulary are broken
+        std::string probe;
+        for (unsigned byte = 1; byte < 256; byte++)
+        {
+            if (byte != ' ' && byte != '\n')
+            {
+                probe += static_cast<char>(byte);
+            }
+        }
+        probe += " The quick brown fox jumps over the lazy dog";
+        std::string decoded;
+        for (const auto &token : tokenizer->tokenize(probe))
+        {
+            decoded += tokenizer->tokenBytes(token);
+        }
+        if (decoded != probe)
+        {
+            return fail(error, "Tokenizer in " + path + " does not round-trip");
+        }
+
+        this->current.store(std::move(tokenizer), std::memory_order_release);
+        this->generation.fetch_add(1, std::memory_order_relaxed);
+        return true;
+    }
+}
@@ -0,0 +1,148 @@
+#include <trace.h>
+#include <atomic>
+#include <bit>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace dokusha::trace
+{
+    namespace
+    {
+        struct Event
+        {
+            const char *name;
+            int64_t begin; // Nanoseconds since the trace epoch
+            int64_t duration;
+        };
+
+        // Written by its own thread only. written counts every event ever recorded, the latest
+        // capacity of them are in events.
+        struct ThreadBuffer
+        {
+            std::unique_ptr<Event[]> events;
+            size_t capacity;
+            std::atomic<uint64_t> written{0};
+            unsigned threadIndex;
+        };
+
+        struct Tracer
+        {
+            std::atomic<bool> enabled{false};
+            std::chrono::steady_clock::time_point epoch = std::chrono::steady_clock::now();
+            size_t eventsPerThread = 1 << 18;
+            std::string path;
+            std::mutex mutex; // Guards buffers and path
+            std::vector<std::unique_ptr<ThreadBuffer>> buffers;
+        };
+
+        Tracer &tracer()
+        {
+            static Tracer instance;
+            return instance;
+        }
+
+        ThreadBuffer &threadBuffer()
+        {
+            thread_local ThreadBuffer *buffer = []
+            {
+                Tracer &state = tracer();
+                std::lock_guard<std::mutex> lock(state.mutex);
+                auto created = std::make_unique<ThreadBuffer>();
+                created->capacity = state.eventsPerThread;
+                created->events = std::make_unique<Event[]>(created->capacity);
+                created->threadIndex = state.buffers.size();
+                state.buffers.push_back(std::move(created));
+                return state.buffers.back().get();
+            }();
+            return *buffer;
+        }
+
+        void writeAtExit()
+        {
+            Tracer &state = tracer();
+            std::string path;
+            {
+                std::lock_guard<std::mutex> lock(state.mutex);
+                path = state.path;
+            }
+            writeChromeTrace(path);
+        }
+
+        // Picks up DOKUSHA_TRACE_FILE when the library is loaded
+        const bool startedFromEnvironment = []
+        {
+            const char *path = std::getenv("DOKUSHA_TRACE_FILE");
+            if (path != nullptr && *path != '\0')
+            {
+                start(path);
+            }
+            return path != nullptr;
+        }();
+    }
+
+    void start(const std::string &path, size_t eventsPerThread)
+    {
+        Tracer &state = tracer();
+        {
+            std::lock_guard<std::mutex> lock(state.mutex);
+            bool registered = !state.path.empty();
+            state.path = path;
+            state.eventsPerThread = std::bit_ceil(std::max<size_t>(eventsPerThread, 2));
+            if (!registered)
+            {
+                std::atexit(writeAtExit);
+            }
+        }
+        state.enabled.store(true, std::memory_order_release);
+    }
+
+    bool enabled()
+    {
+        return tracer().enabled.load(std::memory_order_relaxed);
+    }
+
+    void record(const char *name, std::chrono::steady_clock::time_point begin, std::chrono::steady_clock::time_point end)
+    {
+        const auto epoch = tracer().epoch;
+        ThreadBuffer &buffer = threadBuffer();
+        uint64_t index = buffer.written.load(std::memory_order_relaxed);
+        buffer.events[index & (buffer.capacity - 1)] = Event{
+            name,
+            std::chrono::duration_cast<std::chrono::nanoseconds>(begin - epoch).count(),
+            std::chrono::duration_cast<std::chrono::nanoseconds>(end - begin).count()};
+        buffer.written.store(index + 1, std::memory_order_release);
+    }
+
+    void writeChromeTrace(const std::string &path)
+    {
+        Tracer &state = tracer();
+        std::ofstream out(path);
+        // Timestamps are in microseconds; three fixed decimals keep nanoseconds however long the run, where the
+        // default six significant digits would lose them after a few seconds
+        out << std::fixed << std::setprecision(3);
+        out << "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[";
+        bool first = true;
+
+        std::lock_guard<std::mutex> lock(state.mutex);
+        for (const auto &buffer : state.buffers)
+        {
+            out << (first ? "" : ",") << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << buffer->threadIndex
+                << ",\"args\":{\"name\":\"thread " << buffer->threadIndex << "\"}}";
+            first = false;
+
+            uint64_t written = buffer->written.load(std::memory_order_acquire);
+            uint64_t oldest = written > buffer->capacity ? written - buffer->capacity : 0;
+            for (uint64_t i = oldest; i < written; i++)
+            {
+                const Event &event = buffer->events[i & (buffer->capacity - 1)];
+                out << ",{\"name\":\"" << event.name << "\",\"ph\":\"X\",\"pid\":1,\"tid\":" << buffer->threadIndex
+                    << ",\"ts\":" << event.begin / 1000.0 << ",\"dur\":" << event.duration / 1000.0 << "}";
+            }
+        }
+        out << "]}" << std::endl;
+    }
+}
@@ -0,0 +1,161 @@
+#include <server.h>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <iostream>
+#include <string>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+// Starts a server on a temporary socket, checks that encode and decode round trip through it, and that stop()
+// shuts it down with the connections served so far
+namespace
+{
+    int failures = 0;
+
+    void check(bool condition, const std::string &what)
+    {
+        if (!condition)
+        {
+            std::cerr << "FAILED: " << what << std::endl;
+            failures++;
+        }
+    }
+
+    int connectTo(const std::string &socketPath)
+    {
+        sockaddr_un address{};
+        address.sun_family = AF_UNIX;
+        std::strcpy(address.sun_path, socketPath.c_str());
+        // run() starts listening on its own thread, so the first attempts may come too early
+        for (int attempt = 0; attempt < 500; attempt++)
+        {
+            int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+            if (connect(fd, reinterpret_cast<sockaddr *>(&address), sizeof(address)) == 0)
+            {
+                return fd;
+            }
+            close(fd);
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+        return -1;
+    }
+
+    bool transfer(int fd, void *data, size_t size, bool sending)
+    {
+        char *buffer = static_cast<char *>(data);
+        while (size > 0)
+        {
+            ssize_t count = sending ? send(fd, buffer, size, MSG_NOSIGNAL) : recv(fd, buffer, size, 0);
+            if (count <= 0)
+            {
+                return false;
+            }
+            buffer += count;
+            size -= count;
+        }
+        return true;
+    }
+
+    bool request(int fd, uint8_t op, const std::string &payload, std::string &response)
+    {
+        uint32_t size = payload.size();
+        std::string request(1, static_cast<char>(op));
+        request.append(reinterpret_cast<const char *>(&size), sizeof(size));
+        request += payload;
+        if (!transfer(fd, request.data(), request.size(), true) || !transfer(fd, &size, sizeof(size), false))
+        {
+            return false;
+        }
+        response.resize(size);
+        return transfer(fd, response.data(), size, false);
+    }
+
+    std::shared_ptr<dokusha::BPETokenizer<std::string>> trainTokenizer()
+    {
+        auto tokenizer = std::make_shared<dokusha::BPETokenizer<std::string>>();
+        for (int i = 0; i < 20; i++)
+        {
+            std::string line = "the quick brown fox jumps over the lazy dog and the other dog";
+            tokenizer->addToCorpus(line);
+        }
+        tokenizer->pruneWordList();
+        for (int i = 0; i < 8; i++)
+        {
+            tokenizer->runLearningIteration();
+        }
+        tokenizer->compileMergeTable();
+        return tokenizer;
+    }
+}
+
+int main()
+{
+    auto tokenizer = trainTokenizer();
+    dokusha::TokenizerHandle tokenizers(tokenizer);
+
+    dokusha::ServerOptions options;
+    options.socketPath = (std::filesystem::temp_directory_path() / ("dokusha_server_test_" + std::to_string(getpid()) + ".sock")).string();
+    options.encoderThreads = 2;
+    dokusha::TokenizerServer server(tokenizers, options);
+    std::thread serverThread([&]
+    {
+        try
+        {
+            server.run();
+        }
+        catch (const std::exception &error)
+        {
+            check(false, std::string("run() threw: ") + error.what());
+        }
+    });
+
+    const std::string text = "the lazy fox jumps over the quick dog";
+    const std::vector<unsigned short> expected = tokenizer->tokenize(text);
+
+    // Many short connections, whose threads the server must reap while it keeps accepting
+    const int connectionCount = 32;
+    for (int i = 0; i < connectionCount; i++)
+    {
+        int fd = connectTo(options.socketPath);
+        check(fd >= 0, "connect to " + options.socketPath);
+        if (fd < 0)
+        {
+            break;
+        }
+
+        std::string tokens;
+        check(request(fd, dokusha::TokenizerServer::encodeOp, text, tokens), "encode request");
+        check(tokens.size() == expected.size() * sizeof(unsigned short) &&
+                  std::memcmp(tokens.data(), expected.data(), tokens.size()) == 0,
+              "encoded tokens match tokenize()");
+
+        std::string decoded;
+        check(request(fd, dokusha::TokenizerServer::decodeOp, tokens, decoded), "decode request");
+        check(decoded == text, "decode returns the encoded text");
+        close(fd);
+    }
+
+    // A connection still open at shutdown is closed by the server
+    int idle = connectTo(options.socketPath);
+    check(idle >= 0, "connect before shutdown");
+    std::string stats;
+    check(request(idle, dokusha::TokenizerServer::statsOp, "", stats), "stats request");
+    check(stats.find("\"encode_requests\":" + std::to_string(connectionCount)) != std::string::npos, "stats count the encode requests");
+
+    server.stop();
+    serverThread.join();
+    char byte;
+    check(recv(idle, &byte, 1, 0) == 0, "open connection closed on shutdown");
+    close(idle);
+    check(!std::filesystem::exists(options.socketPath), "socket file removed on shutdown");
+
+    if (failures == 0)
+    {
+        std::cout << "server_test passed" << std::endl;
+    }
+    return failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,241 @@
+#include <bpe.h>
+#include <dokusha.h>
+#include <streaming.h>
+#include <cstdlib>
+#include <filesystem>
+#include <iostream>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+// Trains a small tokenizer and checks every encode path against replaying its merge rules in the order they
+// were learned: the compiled automaton, the merge table under merge limits, the frequent word table of a saved
+// and loaded tokenizer, batches, offsets, streaming, special tokens and the C interface, each with its decode
+namespace
+{
+    using Tokenizer = dokusha::BPETokenizer<std::string>;
+
+    int failures = 0;
+
+    void check(bool condition, const std::string &what)
+    {
+        if (!condition)
+        {
+            std::cerr << "FAILED: " << what << std::endl;
+            failures++;
+        }
+    }
+
+    // The reference encoding: words split like preTokenize splits them, the first mergeLimit rules applied to
+    // each, left to right and one rule at a time
+    std::vector<unsigned short> replayMergeRules(const Tokenizer &tokenizer, const std::string &text, size_t mergeLimit)
+    {
+        std::vector<unsigned short> ids;
+        for (auto &tokens : tokenizer.preTokenize(text))
+        {
+            for (size_t rank = 0; rank < std::min(mergeLimit, tokenizer.getMergeRuleCount()) && tokens.size() > 1; rank++)
+            {
+                const auto &[pair, merged] = tokenizer.getMergeRule(rank);
+                std::vector<std::string> next;
+                for (size_t i = 0; i < tokens.size(); i++)
+                {
+                    if (i + 1 < tokens.size() && tokens[i] == pair.first && tokens[i + 1] == pair.second)
+                    {
+                        next.push_back(merged);
+                        i++;
+                    }
+                    else
+                    {
+                        next.push_back(tokens[i]);
+                    }
+                }
+                tokens = std::move(next);
+            }
+            for (const auto &token : tokens)
+            {
+                ids.push_back(tokenizer.tokenId(token).value_or(0));
+            }
+        }
+        return ids;
+    }
+
+    Tokenizer trainTokenizer(size_t merges)
+    {
+        const std::vector<std::string> corpus = {
+            "the quick brown fox jumps over the lazy dog",
+            "a lazy dog sleeps in the sun while the fox runs",
+            "pack my box with five dozen liquor jugs",
+            "über straße naïve café déjà vu",
+            "東京 と 大阪 の 間 の 距離"};
+        Tokenizer tokenizer;
+        for (int i = 0; i < 30; i++)
+        {
+            for (const auto &text : corpus)
+            {
+                std::string line = text;
+                tokenizer.addToCorpus(line);
+            }
+        }
+        tokenizer.pruneWordList();
+        for (size_t i = 0; i < merges; i++)
+        {
+            unsigned short before = tokenizer.getVocabularySize();
+            tokenizer.runLearningIteration();
+            if (tokenizer.getVocabularySize() == before)
+            {
+                break;
+            }
+        }
+        return tokenizer;
+    }
+
+    std::string trimmed(const std::string &text)
+    {
+        return std::string(trimmedView(text));
+    }
+}
+
+int main()
+{
+    const std::vector<std::string> texts = {
+        "the quick brown fox jumps over the lazy dog",
+        "the fox",
+        "  leading and trailing spaces  ",
+        "double  spaces   and\nnewlines\ninside",
+        "unseen words: zebra quartz xylophone",
+        "über café 東京 の 距離 déjà",
+        "x",
+        ""};
+
+    Tokenizer tokenizer = trainTokenizer(120);
+    const size_t mergeCount = tokenizer.getMergeRuleCount();
+    check(mergeCount > 50, "training learned merges");
+
+    // Before compiling, encodeWord replays the rules itself
+    for (const auto &text : texts)
+    {
+        check(tokenizer.tokenize(text) == replayMergeRules(tokenizer, text, mergeCount), "uncompiled tokenize: " + text);
+    }
+
+    tokenizer.compileMergeTable();
+    std::vector<std::vector<unsigned short>> batch = tokenizer.tokenizeBatch(texts);
+    for (size_t i = 0; i < texts.size(); i++)
+    {
+        const std::string &text = texts[i];
+        std::vector<unsigned short> expected = replayMergeRules(tokenizer, text, mergeCount);
+        check(tokenizer.tokenize(text) == expected, "automaton tokenize: " + text);
+        check(batch[i] == expected, "tokenizeBatch: " + text);
+        check(tokenizer.countTokens(text) == expected.size(), "countTokens: " + text);
+        check(tokenizer.tokenize(text, 3) == std::vector<unsigned short>(expected.begin(), expected.begin() + std::min<size_t>(3, expected.size())),
+              "tokenize with maxTokens: " + text);
+        check(tokenizer.detokenize(expected) == trimmed(text), "detokenize round trip: " + text);
+
+        dokusha::TokenizedText withOffsets = tokenizer.tokenizeWithOffsets(text);
+        check(withOffsets.ids == expected && withOffsets.offsets.size() == expected.size(), "tokenizeWithOffsets ids: " + text);
+        for (size_t j = 0; j < withOffsets.offsets.size(); j++)
+        {
+            std::string_view bytes = tokenizer.tokenBytes(withOffsets.ids[j]);
+            check(text.compare(withOffsets.offsets[j], bytes.size(), bytes) == 0, "token offset points at its bytes: " + text);
+        }
+
+        // Every smaller vocabulary passed in training goes through the merge table with a rank limit
+        for (size_t mergeLimit : {size_t(0), size_t(1), size_t(7), mergeCount / 2, mergeCount})
+        {
+            std::vector<unsigned short> limited = tokenizer.tokenizeWithMergeLimit(text, mergeLimit);
+            check(limited == replayMergeRules(tokenizer, text, mergeLimit), "tokenizeWithMergeLimit " + std::to_string(mergeLimit) + ": " + text);
+            check(tokenizer.detokenizeWithMergeLimit(limited, mergeLimit) == trimmed(text), "detokenizeWithMergeLimit round trip: " + text);
+        }
+    }
+    std::vector<unsigned short> fullVocabulary = tokenizer.tokenize("the quick brown fox");
+    check(!tokenizer.detokenizeWithMergeLimit(fullVocabulary, 0).has_value(), "merged tokens rejected under merge limit 0");
+
+    std::vector<std::vector<unsigned short>> decodeBatch(batch.begin(), batch.end());
+    std::vector<std::string> decoded = tokenizer.detokenizeBatch(decodeBatch);
+    for (size_t i = 0; i < texts.size(); i++)
+    {
+        check(decoded[i] == trimmed(texts[i]), "detokenizeBatch: " + texts[i]);
+    }
+
+    // Streaming in 3 byte chunks, which split words and multi-byte characters
+    dokusha::StreamingEncoder encoder(tokenizer);
+    dokusha::StreamingDecoder decoder(tokenizer);
+    for (const auto &text : texts)
+    {
+        if (!text.empty() && text.front() == ' ')
+        {
+            continue; // Only matches tokenize() for input that does not start with whitespace
+        }
+        std::vector<unsigned short> streamed;
+        for (size_t begin = 0; begin < text.size(); begin += 3)
+        {
+            encoder.feed(std::string_view(text).substr(begin, 3), streamed);
+        }
+        encoder.finish(streamed);
+        check(streamed == replayMergeRules(tokenizer, text, mergeCount), "StreamingEncoder: " + text);
+
+        std::string streamedText;
+        for (const auto &id : streamed)
+        {
+            streamedText += decoder.push(id);
+        }
+        streamedText += decoder.finish();
+        check(streamedText == trimmed(text), "StreamingDecoder: " + text);
+    }
+
+    // The saved file carries the encodings of the most frequent words, which the loaded tokenizer uses first
+    std::string path = (std::filesystem::temp_directory_path() / ("dokusha_tokenizer_test_" + std::to_string(getpid()) + ".bin")).string();
+    tokenizer.save(path, 20);
+    Tokenizer loaded;
+    check(loaded.load(path), "load saved tokenizer");
+    for (const auto &text : texts)
+    {
+        check(loaded.tokenize(text) == replayMergeRules(tokenizer, text, mergeCount), "loaded tokenize with frequent words: " + text);
+    }
+
+    dokusha_tokenizer *handle = dokusha_load(path.c_str());
+    check(handle != nullptr, "dokusha_load");
+    if (handle != nullptr)
+    {
+        check(dokusha_merge_count(handle) == mergeCount, "dokusha_merge_count");
+        for (const auto &text : texts)
+        {
+            std::vector<unsigned short> expected = replayMergeRules(tokenizer, text, mergeCount);
+            std::vector<uint16_t> ids(text.size() + 1);
+            size_t count = dokusha_encode(handle, text.data(), text.size(), ids.data(), ids.size());
+            ids.resize(std::min(count, ids.size()));
+            check(count == expected.size() && std::equal(ids.begin(), ids.end(), expected.begin()), "dokusha_encode: " + text);
+
+            std::string decodedText(text.size() + 1, '\0');
+            size_t length = dokusha_decode(handle, ids.data(), ids.size(), decodedText.data(), decodedText.size());
+            decodedText.resize(std::min(length, decodedText.size()));
+            check(decodedText == trimmed(text), "dokusha_decode round trip: " + text);
+
+            std::vector<uint16_t> limited(text.size() + 1);
+            count = dokusha_encode_with_merge_limit(handle, text.data(), text.size(), limited.data(), limited.size(), 7);
+            limited.resize(std::min(count, limited.size()));
+            std::vector<unsigned short> expectedLimited = replayMergeRules(tokenizer, text, 7);
+            check(count == expectedLimited.size() && std::equal(limited.begin(), limited.end(), expectedLimited.begin()),
+                  "dokusha_encode_with_merge_limit: " + text);
+        }
+        dokusha_free(handle);
+    }
+    std::filesystem::remove(path);
+
+    // Special tokens are cut out before words are split, and everything around them encodes as usual
+    const unsigned short endOfText = loaded.getVocabularySize() + 10;
+    check(loaded.addSpecialToken("<|endoftext|>", endOfText), "addSpecialToken");
+    std::string withSpecial = "the fox<|endoftext|>lazy dog";
+    std::vector<unsigned short> expected = replayMergeRules(tokenizer, "the fox", mergeCount);
+    expected.push_back(endOfText);
+    std::vector<unsigned short> after = replayMergeRules(tokenizer, "lazy dog", mergeCount);
+    expected.insert(expected.end(), after.begin(), after.end());
+    check(loaded.tokenize(withSpecial) == expected, "tokenize with a special token");
+    check(loaded.tokenizeWithOffsets(withSpecial).ids == expected, "tokenizeWithOffsets with a special token");
+    check(loaded.detokenize(expected) == withSpecial, "detokenize with a special token");
+
+    if (failures == 0)
+    {
+        std::cout << "tokenizer_test passed" << std::endl;
+    }
+    return failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,80 @@
+#include <pipeline.h>
+#include <cassert>
+#include <filesystem>
+#include <thread>
+
+using recursive_directory_iterator = std::filesystem::recursive_directory_iterator;
+
+// Usage: encode <tokenizer_state.bin> <corpus file or directory> <output directory>
+//               [--threads N] [--width 2|4] [--shard-tokens N]
+int main(int argc, char **argv)
+{
+    assert(argc >= 4);
+    dokusha::EncodePipelineOptions options;
+    options.outputDirectory = argv[3];
+
+    unsigned threads = std::max(1u, std::thread::hardware_concurrency());
+    for (int i = 4; i + 1 < argc; i += 2)
+    {
+        std::string flag = argv[i];
+        if (flag == "--threads")
+        {
+            threads = std::max(1, std::stoi(argv[i + 1]));
+        }
+        else if (flag == "--width")
+        {
+            options.tokenWidth = std::stoul(argv[i + 1]);
+        }
+        else if (flag == "--shard-tokens")
+        {
+            options.shardTokens = std::stoull(argv[i + 1]);
+        }
+    }
+    // Finding line ends is a fraction of the cost of encoding, so most threads go to the encoders
+    options.splitterThreads = std::max(1u, threads / 4);
+    options.encoderThreads = threads;
+
+    std::vector<std::string> inputFiles;
+    if (std::filesystem::is_directory(argv[2]))
+    {
+        for (const auto &textFile : recursive_directory_iterator(argv[2]))
+        {
+            if (textFile.is_regular_file())
+            {
+                inputFiles.push_back(textFile.path().string());
+            }
+        }
+        std::sort(inputFiles.begin(), inputFiles.end());
+    }
+    else
+    {
+        inputFiles.push_back(argv[2]);
+    }
+
+    dokusha::BPETokenizer<std::string> tokenizer;
+    if (!tokenizer.load(argv[1]))
+    {
+        std::cerr << "Unable to load the tokenizer from " << argv[1] << std::endl;
+        return 1;
+    }
+
+    dokusha::EncodePipeline pipeline(tokenizer, options);
+    dokusha::EncodePipelineStats stats;
+    try
+    {
+        stats = pipeline.run(inputFiles);
+    }
+    catch (const std::exception &error)
+    {
+        std::cerr << "Encoding failed: " << error.what() << std::endl;
+        return 1;
+    }
+
+    std::cout << "Files: " << inputFiles.size() << ", Documents: " << stats.documents
+              << ", Tokens: " << stats.tokens << ", Shards: " << stats.shards << std::endl;
+    std::cout << "Read " << stats.bytesRead / 1e6 << " MB in " << stats.seconds << " s ("
+              << stats.bytesRead / 1e6 / stats.seconds << " MB/s, "
+              << stats.tokens / stats.seconds << " tokens/s)" << std::endl;
+
+    return 0;
+}
@@ -0,0 +1,85 @@
+#include <server.h>
+#include <cassert>
+#include <csignal>
+#include <iostream>
+#include <thread>
+
+// Usage: serve <tokenizer_state.bin> <socket path>
+//              [--threads N] [--max-batch N] [--batch-delay-us N]
+int main(int argc, char **argv)
+{
+    assert(argc >= 3);
+    dokusha::ServerOptions options;
+    options.socketPath = argv[2];
+    options.encoderThreads = std::max(1u, std::thread::hardware_concurrency());
+    for (int i = 3; i + 1 < argc; i += 2)
+    {
+        std::string flag = argv[i];
+        if (flag == "--threads")
+        {
+            options.encoderThreads = std::max(1, std::stoi(argv[i + 1]));
+        }
+        else if (flag == "--max-batch")
+        {
+            options.maxBatch = std::max(1, std::stoi(argv[i + 1]));
+        }
+        else if (flag == "--batch-delay-us")
+        {
+            options.batchDelay = std::chrono::microseconds(std::stoul(argv[i + 1]));
+        }
+    }
+
+    dokusha::TokenizerHandle tokenizers;
+    std::string error;
+    if (!tokenizers.reload(argv[1], &error))
+    {
+        std::cerr << error << std::endl;
+        return 1;
+    }
+
+    // Signals are taken by a dedicated thread, which is blocked from them everywhere else
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTERM);
+    sigaddset(&signals, SIGHUP);
+    pthread_sigmask(SIG_BLOCK, &signals, nullptr);
+
+    // SIGHUP reloads the tokenizer file in place, requests in flight finish on the old tokenizer
+    dokusha::TokenizerServer server(tokenizers, options);
+    std::thread signalThread([&]
+    {
+        int signal;
+        while (sigwait(&signals, &signal) == 0 && signal == SIGHUP)
+        {
+            std::string reloadError;
+            if (tokenizers.reload(argv[1], &reloadError))
+            {
+                std::cout << "Reloaded " << argv[1] << ", version " << tokenizers.version() << std::endl;
+            }
+            else
+            {
+                std::cerr << "Reload failed, keeping the current tokenizer: " << reloadError << std::endl;
+            }
+        }
+        server.stop();
+    });
+
+    std::cout << "Serving " << argv[1] << " on " << options.socketPath << " with " << options.encoderThreads << " encoder threads" << std::endl;
+    int status = 0;
+    try
+    {
+        server.run();
+        std::cout << server.statsJson() << std::endl;
+    }
+    catch (const std::exception &error)
+    {
+        std::cerr << error.what() << std::endl;
+        status = 1;
+    }
+
+    // Releases the signal thread if run() ended on its own
+    pthread_kill(signalThread.native_handle(), SIGTERM);
+    signalThread.join();
+    return status;
+}